@@ -0,0 +1,249 @@
+#include "disposable.h"
+#include "triple_buffer.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+#pragma once
+
+/**
+ * Latest-value storage which migrates between internal engines depending on observed load.
+ * Quiet periods are served by the lock-and-copy Disposable engine, bursts with contended
+ * or overwritten puts are served by a wait-free TripleBuffer.
+ *
+ * Statistics are gathered per window of puts. A migration is decided at the end of a window
+ * and carried out by the producer as soon as the current engine is quiescent, i.e. the consumer
+ * has taken the latest value. Puts after the switch go to the new engine only, so the consumer
+ * never observes values out of order.
+ *
+ * It's assumed that there's only one Producer and a single Consumer.
+ */
+template <typename T, typename YieldF = void (*)(), unsigned int block_retries = 2>
+class AdaptiveDisposable {
+public:
+    using Type = T;
+    using Yielder = YieldF;
+    static constexpr unsigned int BLOCK_RETRIES = block_retries;
+
+    enum class Engine : uint8_t {
+        LOCK_COPY,
+        TRIPLE_BUFFER,
+    };
+
+    struct Policy {
+        // number of puts per statistics window
+        unsigned window = 1024;
+        // lock-copy -> triple buffer when contended operations per mille reach this value
+        unsigned contention_enter_per_mille = 125;
+        // triple buffer -> lock-copy when overwritten puts per mille drop below this value
+        unsigned overwrite_leave_per_mille = 62;
+    };
+
+    struct Migration {
+        Engine from;
+        Engine to;
+        unsigned long long put_count;
+        unsigned contention_per_mille;
+        unsigned overwrite_per_mille;
+    };
+
+    using MigrationLog = void (*)(const Migration &);
+
+    static const char *engine_name(Engine e) {
+        switch (e) {
+        case Engine::LOCK_COPY:
+            return "lock-copy";
+        case Engine::TRIPLE_BUFFER:
+            return "triple-buffer";
+        }
+
+        return "unknown";
+    }
+
+    static void log_migration(const Migration &m) {
+        fprintf(stderr, "[adaptive] %s -> %s after %llu puts (contention %u/1000, overwrite %u/1000)\n",
+                engine_name(m.from), engine_name(m.to), m.put_count,
+                m.contention_per_mille, m.overwrite_per_mille);
+    }
+
+    AdaptiveDisposable(Yielder &&yield, const Policy &policy = Policy{}, MigrationLog log = &log_migration)
+        : _lock_copy{Yielder{yield}}, _engine{Engine::LOCK_COPY}, _policy{policy}, _log{log}
+    {}
+
+    /**
+     * Non-blocking read and copy.
+     * The storage becomes empty on successfull read.
+     *
+     * \param ret target memory location to copy into
+     * \returns \c true if copy was successfull, \c false if the read was blocked by simultaneous write or the storage was empty.
+     */
+    bool try_read_into(T &ret) {
+        switch (_engine.load(std::memory_order_acquire)) {
+        case Engine::LOCK_COPY: {
+            // polls of an empty storage aren't contention
+            bool write_blocked = false;
+            const bool rc = _lock_copy.read(ret, write_blocked);
+
+            if (write_blocked) {
+                _contended_reads.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return rc;
+        }
+
+        case Engine::TRIPLE_BUFFER:
+            return _triple.try_read_into(ret);
+        }
+
+        return false;
+    }
+
+    /**
+     * Non-blocking write.
+     *
+     * \param v value to store
+     * \returns \c true if write was successfull, \c false if the operation was blocked by simultaneous read
+     */
+    bool try_put(const T &v) {
+        if (_target != _current && _is_quiescent(_current)) {
+            _migrate();
+        }
+
+        bool overwrote = false;
+        bool rc = true;
+
+        switch (_current) {
+        case Engine::LOCK_COPY: {
+            unsigned retries = 0;
+            rc = _lock_copy.put(v, retries, overwrote);
+            _window_contended += retries != 0;
+            break;
+        }
+
+        case Engine::TRIPLE_BUFFER:
+            _triple.try_put(v, &overwrote);
+            break;
+        }
+
+        _window_overwrites += overwrote;
+        ++_put_count;
+
+        if (++_window_puts == _policy.window) {
+            _close_window();
+        }
+
+        return rc;
+    }
+
+    // Engine currently used by the producer
+    Engine engine() const {
+        return _engine.load(std::memory_order_relaxed);
+    }
+
+protected:
+    class LockCopyEngine : public Disposable<T, YieldF, block_retries> {
+    public:
+        using Base = Disposable<T, YieldF, block_retries>;
+
+        LockCopyEngine(YieldF &&yield) : Base{std::move(yield)} {}
+
+        bool read(T &ret, bool &write_blocked) {
+            if (!this->_try_block_for_read(&write_blocked)) {
+                return false;
+            }
+
+            ret = this->_storage;
+            this->_unblock_after_read_and_empty_storage();
+
+            return true;
+        }
+
+        bool put(const T &v, unsigned &retries, bool &overwrote) {
+            if (!this->_try_block_for_write(&retries)) {
+                return false;
+            }
+
+            // the consumer can't touch the state while it's blocked for write
+            overwrote = !(this->_state.load() & Base::STATE_STORAGE_EMPTY_MASK);
+            this->_storage = v;
+            this->_unblock_after_write_and_fill_storage();
+
+            return true;
+        }
+
+        // the consumer has taken the latest value and released the storage
+        bool is_quiescent() const {
+            const auto state = this->_state.load();
+            return (state & Base::STATE_STORAGE_EMPTY_MASK) && !(state & Base::STATE_READ_BLOCK_MASK);
+        }
+    };
+
+    LockCopyEngine _lock_copy;
+    TripleBuffer<T> _triple;
+
+    std::atomic<Engine> _engine;
+    std::atomic<unsigned> _contended_reads{0};
+
+    // producer side only
+    Policy _policy;
+    MigrationLog _log;
+    Engine _current = Engine::LOCK_COPY;
+    Engine _target = Engine::LOCK_COPY;
+    unsigned long long _put_count = 0;
+    unsigned _window_puts = 0;
+    unsigned _window_contended = 0;
+    unsigned _window_overwrites = 0;
+    unsigned _window_contended_reads_base = 0;
+    unsigned _last_contention_per_mille = 0;
+    unsigned _last_overwrite_per_mille = 0;
+
+    bool _is_quiescent(Engine e) const {
+        switch (e) {
+        case Engine::LOCK_COPY:
+            return _lock_copy.is_quiescent();
+
+        case Engine::TRIPLE_BUFFER:
+            return _triple.is_quiescent();
+        }
+
+        return false;
+    }
+
+    void _close_window() {
+        const unsigned reads_total = _contended_reads.load(std::memory_order_relaxed);
+        const unsigned contended = _window_contended + (reads_total - _window_contended_reads_base);
+
+        _last_contention_per_mille = contended >= _window_puts ? 1000 : contended * 1000ull / _window_puts;
+        _last_overwrite_per_mille = _window_overwrites * 1000ull / _window_puts;
+
+        switch (_current) {
+        case Engine::LOCK_COPY:
+            _target = _last_contention_per_mille >= _policy.contention_enter_per_mille
+                ? Engine::TRIPLE_BUFFER : Engine::LOCK_COPY;
+            break;
+
+        case Engine::TRIPLE_BUFFER:
+            _target = _last_overwrite_per_mille < _policy.overwrite_leave_per_mille
+                ? Engine::LOCK_COPY : Engine::TRIPLE_BUFFER;
+            break;
+        }
+
+        _window_contended_reads_base = reads_total;
+        _window_puts = 0;
+        _window_contended = 0;
+        _window_overwrites = 0;
+    }
+
+    // called by the producer only when the current engine is quiescent
+    void _migrate() {
+        const Migration m{_current, _target, _put_count, _last_contention_per_mille, _last_overwrite_per_mille};
+
+        _current = _target;
+        _engine.store(_current, std::memory_order_release);
+
+        if (_log) {
+            _log(m);
+        }
+    }
+};
@@ -0,0 +1,66 @@
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#pragma once
+
+/**
+ * Pin the calling thread to a single CPU.
+ *
+ * \param cpu CPU number, negative values leave the affinity as is
+ * \returns \c false if the affinity couldn't be set
+ */
+inline bool pin_this_thread(int cpu) {
+    if (cpu < 0) {
+        return true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/**
+ * Pin another thread to a single CPU.
+ *
+ * \param cpu CPU number, negative values leave the affinity as is
+ * \returns \c false if the affinity couldn't be set
+ */
+inline bool pin_thread(std::thread &t, int cpu) {
+    if (cpu < 0) {
+        return true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) == 0;
+}
+
+// Pins the calling thread for its lifetime and restores the previous affinity afterwards
+class ScopedPin {
+public:
+    explicit ScopedPin(int cpu) {
+        _saved = cpu >= 0 && pthread_getaffinity_np(pthread_self(), sizeof(_previous), &_previous) == 0;
+
+        if (_saved) {
+            pin_this_thread(cpu);
+        }
+    }
+
+    ScopedPin(const ScopedPin &) = delete;
+    ScopedPin &operator=(const ScopedPin &) = delete;
+
+    ~ScopedPin() {
+        if (_saved) {
+            pthread_setaffinity_np(pthread_self(), sizeof(_previous), &_previous);
+        }
+    }
+
+private:
+    cpu_set_t _previous;
+    bool _saved;
+};
@@ -0,0 +1,104 @@
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#pragma once
+
+/**
+ * Noisy neighbors for the benchmarks: threads which compete with the producer and the consumer
+ * for memory bandwidth, last level cache and cache lines.
+ */
+
+struct AntagonistConfig {
+    // sequential read-modify-write over a large buffer, saturates memory bandwidth
+    unsigned streamers = 0;
+    size_t stream_bytes = size_t{256} << 20;
+    // random line accesses over a buffer larger than LLC, evicts everybody else
+    unsigned thrashers = 0;
+    size_t thrash_bytes = size_t{64} << 20;
+    // atomic increments of a line next to the slot under test
+    unsigned false_sharers = 0;
+
+    unsigned total() const { return streamers + thrashers + false_sharers; }
+};
+
+class Antagonists {
+public:
+    Antagonists() = default;
+    Antagonists(const Antagonists &) = delete;
+    Antagonists &operator=(const Antagonists &) = delete;
+
+    ~Antagonists() { stop(); }
+
+    /**
+     * Start the antagonist threads.
+     *
+     * \param neighbor word hammered by the false sharing threads, may be \c nullptr if there are none
+     */
+    void start(const AntagonistConfig &cfg, std::atomic<uint64_t> *neighbor) {
+        _stop.store(false);
+
+        for (unsigned i = 0; i < cfg.streamers; ++i) {
+            _threads.emplace_back([this, bytes = cfg.stream_bytes] () { _stream(bytes); });
+        }
+
+        for (unsigned i = 0; i < cfg.thrashers; ++i) {
+            _threads.emplace_back([this, bytes = cfg.thrash_bytes, i] () { _thrash(bytes, i + 1); });
+        }
+
+        for (unsigned i = 0; neighbor && i < cfg.false_sharers; ++i) {
+            _threads.emplace_back([this, neighbor] () { _false_share(*neighbor); });
+        }
+    }
+
+    void stop() {
+        _stop.store(true);
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+
+        _threads.clear();
+    }
+
+private:
+    static constexpr size_t LINE = 64;
+
+    std::atomic<bool> _stop{false};
+    std::vector<std::thread> _threads;
+
+    void _stream(size_t bytes) {
+        const size_t words = bytes / sizeof(uint64_t);
+        std::unique_ptr<uint64_t[]> buf{new uint64_t[words]()};
+
+        while (!_stop.load(std::memory_order_relaxed)) {
+            for (size_t i = 0; i < words; ++i) {
+                buf[i] += i;
+            }
+        }
+    }
+
+    void _thrash(size_t bytes, uint64_t seed) {
+        const size_t lines = bytes / LINE;
+        std::unique_ptr<unsigned char[]> buf{new unsigned char[lines * LINE]()};
+        uint64_t x = seed * 0x9e3779b97f4a7c15ull;
+
+        while (!_stop.load(std::memory_order_relaxed)) {
+            for (unsigned i = 0; i < 4096; ++i) {
+                // xorshift64
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                ++buf[(x % lines) * LINE];
+            }
+        }
+    }
+
+    void _false_share(std::atomic<uint64_t> &neighbor) {
+        while (!_stop.load(std::memory_order_relaxed)) {
+            neighbor.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
@@ -0,0 +1,171 @@
+#include "disposable.h"
+
+#include <assert.h>
+#include <atomic>
+#include <stdint.h>
+
+#pragma once
+
+/**
+ * Latest-value storage fed by several redundant producers (lines) publishing the same sequenced data.
+ * A put is accepted only if its sequence number is strictly newer than the last accepted one,
+ * so the first arrival of every update wins and the consumer gets a single deduplicated stream.
+ *
+ * Producers are serialized among themselves with a tiny spin lock taken only for sequences which
+ * look newer; duplicates from the slower line are rejected without it. Per-line statistics tell
+ * how often each line won and how many sequence numbers were missing from its own stream.
+ *
+ * It's assumed that there are up to max_lines Producers, one per line, and a single Consumer.
+ */
+template <typename T, typename YieldF = void (*)(), unsigned int block_retries = 2, unsigned int max_lines = 4>
+class ArbitratedDisposable {
+public:
+    using Type = T;
+    using Yielder = YieldF;
+    static constexpr unsigned int BLOCK_RETRIES = block_retries;
+    static constexpr unsigned int MAX_LINES = max_lines;
+
+    enum class PutResult {
+        ACCEPTED,
+        // the sequence has already been delivered by another line or is older
+        STALE,
+        // blocked by simultaneous read, another line may still deliver the sequence
+        BLOCKED,
+    };
+
+    struct LineStats {
+        unsigned long long wins;
+        unsigned long long losses;
+        // sequence numbers skipped by this line's own stream
+        unsigned long long gaps;
+    };
+
+    ArbitratedDisposable(Yielder &&yield) : _slot{Yielder{yield}}, _yield{yield} {}
+
+    /**
+     * Non-blocking write from a line.
+     *
+     * \param line id of the calling producer, less than MAX_LINES
+     * \param seq sequence number of the update, starting from 1
+     * \param v value to store
+     */
+    PutResult try_put(unsigned line, uint64_t seq, const T &v) {
+        assert(line < MAX_LINES && "Invalid line");
+
+        Line &l = _lines[line];
+
+        if (l.last_seq && seq > l.last_seq + 1) {
+            _bump(l.gaps, seq - l.last_seq - 1);
+        }
+
+        if (seq > l.last_seq) {
+            l.last_seq = seq;
+        }
+
+        if (seq <= _last_seq.load(std::memory_order_acquire)) {
+            _bump(l.losses);
+            return PutResult::STALE;
+        }
+
+        while (_producers.test_and_set(std::memory_order_acquire)) {
+            _yield();
+        }
+
+        PutResult ret = PutResult::STALE;
+
+        if (seq > _last_seq.load(std::memory_order_relaxed)) {
+            const uint64_t last = _last_seq.load(std::memory_order_relaxed);
+
+            if (_slot.try_put(Sequenced{seq, v})) {
+                if (last && seq > last + 1) {
+                    _missed.fetch_add(seq - last - 1, std::memory_order_relaxed);
+                }
+
+                _last_seq.store(seq, std::memory_order_release);
+                ret = PutResult::ACCEPTED;
+            } else {
+                ret = PutResult::BLOCKED;
+            }
+        }
+
+        _producers.clear(std::memory_order_release);
+
+        if (ret == PutResult::ACCEPTED) {
+            _bump(l.wins);
+        } else if (ret == PutResult::STALE) {
+            _bump(l.losses);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Non-blocking read and copy.
+     * The storage becomes empty on successfull read.
+     *
+     * \param ret target memory location to copy into
+     * \param seq receives the sequence number of the value if not \c nullptr
+     * \returns \c true if copy was successfull, \c false if the read was blocked by simultaneous write or the storage was empty.
+     */
+    bool try_read_into(T &ret, uint64_t *seq = nullptr) {
+        if (!_slot.try_read_into(_read)) {
+            return false;
+        }
+
+        ret = _read.value;
+
+        if (seq) {
+            *seq = _read.seq;
+        }
+
+        return true;
+    }
+
+    LineStats line_stats(unsigned line) const {
+        const Line &l = _lines[line];
+
+        return LineStats{l.wins.load(std::memory_order_relaxed), l.losses.load(std::memory_order_relaxed),
+                         l.gaps.load(std::memory_order_relaxed)};
+    }
+
+    // Share of updates first delivered by the line among those it delivered at all
+    double win_rate(unsigned line) const {
+        const LineStats s = line_stats(line);
+        return s.wins + s.losses ? static_cast<double>(s.wins) / (s.wins + s.losses) : 0;
+    }
+
+    // Sequence numbers delivered by no line in time
+    unsigned long long missed() const { return _missed.load(std::memory_order_relaxed); }
+
+    uint64_t last_seq() const { return _last_seq.load(std::memory_order_relaxed); }
+
+protected:
+    struct Sequenced {
+        uint64_t seq;
+        Type value;
+    };
+
+    struct alignas(64) Line {
+        // written by the line's producer only
+        uint64_t last_seq = 0;
+        std::atomic<unsigned long long> wins{0};
+        std::atomic<unsigned long long> losses{0};
+        std::atomic<unsigned long long> gaps{0};
+    };
+
+    Disposable<Sequenced, YieldF, block_retries> _slot;
+    Yielder _yield;
+
+    alignas(64) std::atomic<uint64_t> _last_seq{0};
+    std::atomic_flag _producers = ATOMIC_FLAG_INIT;
+    std::atomic<unsigned long long> _missed{0};
+
+    Line _lines[MAX_LINES];
+
+    // consumer side only
+    Sequenced _read;
+
+    static void _bump(std::atomic<unsigned long long> &counter, unsigned long long by = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,170 @@
+#include "disposable.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#pragma once
+
+/**
+ * Allocation support for payloads owning heap memory (std::pmr containers and strings).
+ *
+ * A deep copy of such a payload allocates through the allocator of the target, so each party gets
+ * its own resource and the producer and the consumer never meet in malloc:
+ *   - values built by the producer and copies taken by the consumer come from the thread's
+ *     BumpArena, see thread_arena(), and are dropped all at once at the end of an epoch, see ArenaEpoch;
+ *   - the storage of the slot lives in a pool owned by the slot, see ArenaDisposable.
+ */
+
+/**
+ * Monotonic arena: allocation is a pointer bump, deallocation is a no-op and reset() drops
+ * everything at once. After a reset the chunks are coalesced into one large enough for the
+ * previous epoch, so a steady workload stops asking the upstream resource for memory.
+ * Not thread safe, meant to be used by a single thread.
+ */
+class BumpArena : public std::pmr::memory_resource {
+public:
+    explicit BumpArena(size_t chunk_size = size_t{64} << 10,
+                       std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : _chunk_size{chunk_size}, _upstream{upstream}
+    {}
+
+    BumpArena(const BumpArena &) = delete;
+    BumpArena &operator=(const BumpArena &) = delete;
+
+    ~BumpArena() override { _release(); }
+
+    // Drop every allocation; nothing allocated from the arena may be used afterwards
+    void reset() {
+        if (_chunks.size() > 1) {
+            size_t total = 0;
+
+            for (const auto &c : _chunks) {
+                total += c.size;
+            }
+
+            _release();
+            _add_chunk(total);
+        }
+
+        if (!_chunks.empty()) {
+            _cur = _chunks.front().begin;
+            _end = _cur + _chunks.front().size;
+        }
+
+        _used = 0;
+    }
+
+    // Bytes handed out since the last reset
+    size_t used() const { return _used; }
+
+    // Chunks requested from the upstream resource over the lifetime
+    unsigned long long upstream_allocations() const { return _upstream_allocations; }
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(_cur) + alignment - 1) & ~(uintptr_t{alignment} - 1);
+
+        if (!_cur || p + bytes > reinterpret_cast<uintptr_t>(_end)) {
+            _add_chunk(std::max(_chunk_size, bytes + alignment));
+            p = (reinterpret_cast<uintptr_t>(_cur) + alignment - 1) & ~(uintptr_t{alignment} - 1);
+        }
+
+        _cur = reinterpret_cast<unsigned char *>(p + bytes);
+        _used += bytes;
+
+        return reinterpret_cast<void *>(p);
+    }
+
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    struct Chunk {
+        unsigned char *begin;
+        size_t size;
+    };
+
+    static constexpr size_t CHUNK_ALIGNMENT = alignof(std::max_align_t);
+
+    size_t _chunk_size;
+    std::pmr::memory_resource *_upstream;
+    std::vector<Chunk> _chunks;
+    unsigned char *_cur = nullptr;
+    unsigned char *_end = nullptr;
+    size_t _used = 0;
+    unsigned long long _upstream_allocations = 0;
+
+    void _add_chunk(size_t size) {
+        unsigned char *p = static_cast<unsigned char *>(_upstream->allocate(size, CHUNK_ALIGNMENT));
+
+        _chunks.push_back(Chunk{p, size});
+        _cur = p;
+        _end = p + size;
+        ++_upstream_allocations;
+    }
+
+    void _release() {
+        for (const auto &c : _chunks) {
+            _upstream->deallocate(c.begin, c.size, CHUNK_ALIGNMENT);
+        }
+
+        _chunks.clear();
+        _cur = _end = nullptr;
+    }
+};
+
+// Arena of the calling thread
+inline BumpArena &thread_arena() {
+    thread_local BumpArena arena;
+    return arena;
+}
+
+/**
+ * Scope of an epoch: the arena is reset when it ends.
+ * Everything allocated from the arena within the scope has to be gone by then, e.g. the producer
+ * ends an epoch once the values it built were put, the consumer once it's done with its copies.
+ */
+class ArenaEpoch {
+public:
+    explicit ArenaEpoch(BumpArena &arena = thread_arena()) : _arena{arena} {}
+
+    ArenaEpoch(const ArenaEpoch &) = delete;
+    ArenaEpoch &operator=(const ArenaEpoch &) = delete;
+
+    ~ArenaEpoch() { _arena.reset(); }
+
+    BumpArena &arena() const { return _arena; }
+
+private:
+    BumpArena &_arena;
+};
+
+// Holds the pool of the storage, constructed before the Disposable using it
+struct ArenaStoragePool {
+    std::pmr::unsynchronized_pool_resource pool;
+};
+
+/**
+ * Disposable for allocator-aware payloads, i.e. constructible from a std::pmr::polymorphic_allocator.
+ * The storage allocates from a pool owned by the slot, which is only touched by the producer while
+ * the storage is blocked for write, so it needs no synchronization. The consumer copies into values
+ * of its own, usually backed by its thread_arena().
+ *
+ * It's assumed that there's only one Producer and a single Consumer.
+ */
+template <typename T, typename YieldF = void (*)(), unsigned int block_retries = 2>
+class ArenaDisposable : private ArenaStoragePool, public Disposable<T, YieldF, block_retries> {
+public:
+    using Base = Disposable<T, YieldF, block_retries>;
+    using typename Base::Type;
+    using typename Base::Yielder;
+
+    ArenaDisposable(Yielder &&yield)
+        : ArenaStoragePool{}, Base{std::move(yield), std::in_place, std::pmr::polymorphic_allocator<std::byte>{&pool}}
+    {}
+};
@@ -0,0 +1,297 @@
+#include "adaptive_disposable.h"
+#include "antagonists.h"
+#include "bench.h"
+#include "disposable.h"
+#include "layout.h"
+#include "triple_buffer.h"
+#include "yielders.h"
+
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Searches engine, Yielder, block_retries and layout of a slot on this machine
+// and writes the best configurations as type aliases into a header
+
+enum class Objective {
+  P50,
+  P99,
+  THROUGHPUT,
+};
+
+struct Candidate {
+  std::string name;
+  std::string engine;
+  // type of the slot with T for the payload
+  std::string type;
+  std::string yielder;
+  // empty if the layout wasn't searched
+  std::string layout;
+  BenchResult r;
+};
+
+struct Tuner {
+  BenchConfig cfg;
+  AntagonistConfig acfg;
+  Objective objective = Objective::P99;
+  std::vector<Candidate> candidates;
+
+  // lower is better
+  double score(const BenchResult &r) const {
+    switch (objective) {
+    case Objective::P50:
+      return r.p50_ns;
+    case Objective::P99:
+      return r.p99_ns;
+    case Objective::THROUGHPUT:
+      return -(r.handoffs / r.seconds);
+    }
+
+    return 0;
+  }
+
+  // layout is the name of the Layout template, nullptr if the layout isn't part of the search
+  template <typename Layout, typename Payload, typename Yielder, typename... Args>
+  void add(const char *engine, int retries, const std::string &type, const char *yielder, const char *layout,
+           Args &&... args) {
+    std::unique_ptr<Layout> l{new Layout{std::forward<Args>(args)...}};
+    Antagonists antagonists;
+
+    antagonists.start(acfg, &l->neighbor);
+    const BenchResult r = run_handoff<typename Layout::SlotType, Payload>(l->slot, Yielder{}, cfg);
+    antagonists.stop();
+
+    std::string name = std::string{engine} + "/" + Yielder::NAME;
+
+    // only lock based engines retry
+    if (retries >= 0) {
+      name += "/" + std::to_string(retries);
+    }
+
+    if (layout) {
+      name += std::string{"/"} + Layout::NAME;
+    }
+
+    print_result(name.c_str(), r);
+    candidates.push_back(Candidate{name, engine, type, yielder, layout ? layout : "", r});
+  }
+
+  // best candidate of the engine, any engine if nullptr
+  const Candidate *best(const char *engine = nullptr) const {
+    const Candidate *ret = nullptr;
+
+    for (const auto &c : candidates) {
+      if (!c.r.handoffs || (engine && c.engine != engine)) {
+        continue;
+      }
+
+      if (!ret || score(c.r) < score(ret->r)) {
+        ret = &c;
+      }
+    }
+
+    return ret;
+  }
+};
+
+template <typename Payload, template <typename> class Layout, typename Yielder, unsigned retries>
+void search_retries(Tuner &t, const char *yielder, const char *layout) {
+  const std::string suffix = std::string{", "} + yielder + ", " + std::to_string(retries) + ">";
+
+  t.add<Layout<Disposable<Payload, Yielder, retries>>, Payload, Yielder>(
+      "lock-copy", retries, "Disposable<T" + suffix, yielder, layout, Yielder{});
+  t.add<Layout<AdaptiveDisposable<Payload, Yielder, retries>>, Payload, Yielder>(
+      "adaptive", retries, "AdaptiveDisposable<T" + suffix, yielder, layout, Yielder{},
+      typename AdaptiveDisposable<Payload, Yielder, retries>::Policy{}, nullptr);
+}
+
+template <typename Payload, template <typename> class Layout, typename Yielder>
+void search_yielder(Tuner &t, const char *yielder, const char *layout) {
+  search_retries<Payload, Layout, Yielder, 0>(t, yielder, layout);
+  search_retries<Payload, Layout, Yielder, 2>(t, yielder, layout);
+  search_retries<Payload, Layout, Yielder, 8>(t, yielder, layout);
+  search_retries<Payload, Layout, Yielder, 32>(t, yielder, layout);
+
+  // wait-free, the Yielder only paces the consumer
+  t.add<Layout<TripleBuffer<Payload>>, Payload, Yielder>("triple-buffer", -1, "TripleBuffer<T>", yielder, layout);
+}
+
+template <typename Payload, template <typename> class Layout>
+void search_layout(Tuner &t, const char *layout) {
+  search_yielder<Payload, Layout, SpinYielder>(t, "SpinYielder", layout);
+  search_yielder<Payload, Layout, ThreadYielder>(t, "ThreadYielder", layout);
+  search_yielder<Payload, Layout, TpauseYielder>(t, "TpauseYielder", layout);
+  search_yielder<Payload, Layout, ParkYielder>(t, "ParkYielder", layout);
+}
+
+template <size_t size>
+void search(Tuner &t) {
+  // the layout only matters while something writes next to the slot
+  if (t.acfg.false_sharers) {
+    search_layout<BenchPayload<size>, PackedLayout>(t, "PackedLayout");
+    search_layout<BenchPayload<size>, PaddedLayout>(t, "PaddedLayout");
+  } else {
+    // the padded one keeps the slot to itself
+    search_layout<BenchPayload<size>, PaddedLayout>(t, nullptr);
+  }
+}
+
+void write_aliases(FILE *f, const char *prefix, const Candidate &c) {
+  fprintf(f, "// %s\n", c.name.c_str());
+  fprintf(f, "template <typename T>\nusing %sSlot = %s;\n", prefix, c.type.c_str());
+  fprintf(f, "using %sYielder = %s;\n", prefix, c.yielder.c_str());
+
+  if (!c.layout.empty()) {
+    fprintf(f, "template <typename T>\nusing %sLayout = %s<%sSlot<T>>;\n", prefix, c.layout.c_str(), prefix);
+  }
+
+  fprintf(f, "\n");
+}
+
+bool write_header(const char *path, const Tuner &t, size_t payload, const std::string &placement,
+                  const char *objective) {
+  FILE *f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+
+  if (!f) {
+    return false;
+  }
+
+  fprintf(f, "// Generated by disposable_autotune\n");
+  fprintf(f, "// payload %zu bytes, placement: %s\n", payload, placement.c_str());
+  fprintf(f, "// objective %s, %.2f s per candidate, put interval %llu ns, %u antagonists\n//\n",
+          objective, t.cfg.seconds, (unsigned long long)t.cfg.put_interval_ns, t.acfg.total());
+  fprintf(f, "// %-36s %12s %10s %10s %10s\n", "candidate", "Mhandoff/s", "p50 ns", "p99 ns", "p99.9 ns");
+
+  for (const auto &c : t.candidates) {
+    fprintf(f, "// %-36s %12.3f %10llu %10llu %10llu\n", c.name.c_str(), c.r.handoffs / c.r.seconds / 1e6,
+            (unsigned long long)c.r.p50_ns, (unsigned long long)c.r.p99_ns, (unsigned long long)c.r.p999_ns);
+  }
+
+  fprintf(f, "\n#include \"adaptive_disposable.h\"\n#include \"disposable.h\"\n#include \"layout.h\"\n"
+             "#include \"triple_buffer.h\"\n#include \"yielders.h\"\n\n#pragma once\n\n");
+
+  // a configuration per engine, the best one also as plain Tuned*
+  const Candidate *best = t.best();
+
+  if (best) {
+    write_aliases(f, "Tuned", *best);
+  }
+
+  static const std::pair<const char *, const char *> engines[] = {
+    {"lock-copy", "TunedLockCopy"},
+    {"adaptive", "TunedAdaptive"},
+    {"triple-buffer", "TunedTripleBuffer"},
+  };
+
+  for (const auto &e : engines) {
+    if (const Candidate *c = t.best(e.first)) {
+      write_aliases(f, e.second, *c);
+    }
+  }
+
+  return f == stdout || !fclose(f);
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [--payload 64|256|1024|4096] [--placement auto|none|P,C] [--objective p50|p99|throughput]\n"
+          "          [--seconds S] [--interval-ns N] [--false-sharers N] [--output PATH|-]\n"
+          "Runs every engine, Yielder, block_retries and, with false sharers, layout for the payload size and\n"
+          "writes the best configurations as type aliases into a header, disposable_tuned.h by default.\n"
+          "The throughput objective puts back to back unless --interval-ns is given.\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  Tuner t;
+  const char *placement = "auto";
+  const char *objective = "p99";
+  const char *output = "disposable_tuned.h";
+  size_t payload = 64;
+  bool interval_given = false;
+
+  t.cfg.seconds = 0.2;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--payload") && i + 1 < argc) {
+      payload = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--placement") && i + 1 < argc) {
+      placement = argv[++i];
+    } else if (!strcmp(argv[i], "--objective") && i + 1 < argc) {
+      objective = argv[++i];
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      t.cfg.seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--interval-ns") && i + 1 < argc) {
+      t.cfg.put_interval_ns = strtoull(argv[++i], nullptr, 10);
+      interval_given = true;
+    } else if (!strcmp(argv[i], "--false-sharers") && i + 1 < argc) {
+      t.acfg.false_sharers = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!strcmp(objective, "p50")) {
+    t.objective = Objective::P50;
+  } else if (!strcmp(objective, "p99")) {
+    t.objective = Objective::P99;
+  } else if (!strcmp(objective, "throughput")) {
+    t.objective = Objective::THROUGHPUT;
+
+    // a paced producer caps the throughput of every candidate at the same rate
+    if (!interval_given) {
+      t.cfg.put_interval_ns = 0;
+    }
+  } else {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::string where;
+
+  if (!make_placement(placement, t.cfg, &where)) {
+    fprintf(stderr, "Invalid placement: %s\n", placement);
+    return 2;
+  }
+
+  print_result_header();
+
+  switch (payload) {
+  case 64:
+    search<64>(t);
+    break;
+  case 256:
+    search<256>(t);
+    break;
+  case 1024:
+    search<1024>(t);
+    break;
+  case 4096:
+    search<4096>(t);
+    break;
+  default:
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (!t.best()) {
+    fprintf(stderr, "No candidate completed a handoff\n");
+    return 1;
+  }
+
+  if (!write_header(output, t, payload, where, objective)) {
+    fprintf(stderr, "Can't write %s\n", output);
+    return 1;
+  }
+
+  printf("# best: %s, written to %s\n", t.best()->name.c_str(), output);
+
+  return 0;
+}
@@ -0,0 +1,434 @@
+#include "affinity.h"
+#include "topology.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma once
+
+/**
+ * Building blocks of the handoff benchmarks: payloads carrying a publish timestamp,
+ * latency percentiles, RAPL energy counters and the producer/consumer driver.
+ */
+
+inline uint64_t bench_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <size_t size>
+struct BenchPayload {
+    static_assert(size >= 2 * sizeof(uint64_t), "Payload has to fit the header");
+
+    uint64_t seq;
+    uint64_t put_ns;
+    unsigned char data[size - 2 * sizeof(uint64_t)];
+};
+
+// Payload of variable size, copies go through the allocator like in real feeds
+struct BenchVarPayload {
+    uint64_t seq = 0;
+    uint64_t put_ns = 0;
+    std::vector<unsigned char> data;
+};
+
+// Make the object count as read, so that a copy into it isn't dropped as dead
+template <typename T>
+inline void bench_keep(const T &v) {
+    asm volatile("" : : "r"(&v) : "memory");
+}
+
+template <size_t size>
+void bench_fill(BenchPayload<size> &p, size_t bytes) {
+    memset(p.data, static_cast<unsigned char>(p.seq), std::min(bytes, sizeof(p.data)));
+}
+
+inline void bench_fill(BenchVarPayload &p, size_t bytes) {
+    p.data.assign(bytes, static_cast<unsigned char>(p.seq));
+}
+
+/**
+ * Latency samples with percentiles.
+ * Samples beyond the capacity are dropped, the count of handoffs is kept separately.
+ */
+class LatencyStats {
+public:
+    explicit LatencyStats(size_t capacity = 1 << 22) { _samples.reserve(capacity); }
+
+    void add(uint64_t ns) {
+        if (_samples.size() < _samples.capacity()) {
+            _samples.push_back(ns);
+        }
+    }
+
+    size_t size() const { return _samples.size(); }
+
+    // sorts the samples on the first call
+    uint64_t percentile(double p) {
+        if (_samples.empty()) {
+            return 0;
+        }
+
+        if (!_sorted) {
+            std::sort(_samples.begin(), _samples.end());
+            _sorted = true;
+        }
+
+        const size_t idx = std::min(_samples.size() - 1, static_cast<size_t>(p / 100.0 * _samples.size()));
+        return _samples[idx];
+    }
+
+private:
+    std::vector<uint64_t> _samples;
+    bool _sorted = false;
+};
+
+/**
+ * Package energy from the powercap RAPL zones, summed over all packages.
+ * Counters are usually readable by root only; available() tells whether readings make sense.
+ */
+class RaplMeter {
+public:
+    static constexpr size_t MAX_PACKAGES = 16;
+
+    RaplMeter() {
+        for (size_t i = 0; i < MAX_PACKAGES; ++i) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%zu/energy_uj", i);
+
+            unsigned long long value;
+
+            if (!_read(path, value)) {
+                break;
+            }
+
+            Zone z{};
+            snprintf(z.path, sizeof(z.path), "%s", path);
+            snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%zu/max_energy_range_uj", i);
+
+            if (!_read(path, z.range_uj)) {
+                z.range_uj = 0;
+            }
+
+            _zones.push_back(z);
+        }
+    }
+
+    bool available() const { return !_zones.empty(); }
+
+    void start() {
+        for (auto &z : _zones) {
+            _read(z.path, z.start_uj);
+        }
+    }
+
+    // joules consumed since start()
+    double stop() {
+        double joules = 0;
+
+        for (auto &z : _zones) {
+            unsigned long long now;
+
+            if (!_read(z.path, now)) {
+                continue;
+            }
+
+            // the counter wraps around at max_energy_range_uj
+            const unsigned long long delta = now >= z.start_uj ? now - z.start_uj : now + z.range_uj - z.start_uj;
+            joules += delta / 1e6;
+        }
+
+        return joules;
+    }
+
+private:
+    struct Zone {
+        char path[128];
+        unsigned long long range_uj;
+        unsigned long long start_uj;
+    };
+
+    std::vector<Zone> _zones;
+
+    static bool _read(const char *path, unsigned long long &value) {
+        FILE *f = fopen(path, "r");
+
+        if (!f) {
+            return false;
+        }
+
+        const bool ok = fscanf(f, "%llu", &value) == 1;
+        fclose(f);
+
+        return ok;
+    }
+};
+
+struct BenchConfig {
+    double seconds = 1.0;
+    // pause between puts, 0 publishes as fast as possible; ignored with a workload
+    uint64_t put_interval_ns = 10000;
+    // open-loop arrivals and payload sizes, the producer owns it during the run
+    Workload *workload = nullptr;
+    size_t max_samples = 1 << 22;
+    // CPUs of the producer and the consumer, negative for no pinning, see CpuTopology::propose_pair
+    int producer_cpu = -1;
+    int consumer_cpu = -1;
+};
+
+struct BenchResult {
+    unsigned long long puts = 0;
+    unsigned long long handoffs = 0;
+    double seconds = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t p999_ns = 0;
+    uint64_t max_ns = 0;
+    bool has_energy = false;
+    double joules = 0;
+};
+
+// Sleep until the deadline is close, then spin to hit it precisely
+inline void bench_wait_until(uint64_t deadline_ns) {
+    static constexpr uint64_t SPIN_NS = 50000;
+
+    uint64_t now = bench_now_ns();
+
+    while (now < deadline_ns) {
+        if (deadline_ns - now > SPIN_NS) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - now - SPIN_NS));
+        }
+
+        now = bench_now_ns();
+    }
+}
+
+/**
+ * Run one producer and one consumer over a slot for cfg.seconds.
+ * The latency of a handoff is the age of the value when the consumer gets it.
+ * The consumer calls wait() whenever the slot is empty or blocked.
+ *
+ * With a workload the producer is open-loop: values are stamped with their intended arrival time
+ * and a producer running late catches up without skipping, so the latency includes the time a value
+ * spent waiting for the producer and isn't distorted by coordinated omission.
+ *
+ * The producer runs on the calling thread, which is pinned to cfg.producer_cpu for the duration of the run.
+ */
+template <typename Slot, typename Payload, typename WaitF>
+BenchResult run_handoff(Slot &slot, WaitF wait, const BenchConfig &cfg) {
+    std::atomic<bool> stop{false};
+    LatencyStats stats{cfg.max_samples};
+    BenchResult res;
+    RaplMeter rapl;
+
+    std::thread consumer([&] () {
+        pin_this_thread(cfg.consumer_cpu);
+
+        Payload p;
+        uint64_t last_seq = 0;
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (!slot.try_read_into(p)) {
+                wait();
+                continue;
+            }
+
+            stats.add(bench_now_ns() - p.put_ns);
+            ++res.handoffs;
+
+            if (p.seq <= last_seq) {
+                fprintf(stderr, "Fail (dup) @ seq = %llu\n", (unsigned long long)p.seq);
+            }
+
+            last_seq = p.seq;
+        }
+    });
+
+    ScopedPin pin{cfg.producer_cpu};
+    Payload p{};
+
+    rapl.start();
+
+    const uint64_t start = bench_now_ns();
+    const uint64_t end = start + static_cast<uint64_t>(cfg.seconds * 1e9);
+    uint64_t now = start;
+    uint64_t intended = start;
+
+    while (now < end) {
+        p.seq = res.puts + 1;
+
+        if (cfg.workload) {
+            intended += cfg.workload->arrivals->next_gap_ns(cfg.workload->rng);
+
+            if (intended >= end) {
+                break;
+            }
+
+            bench_fill(p, cfg.workload->sizes.next(cfg.workload->rng));
+            bench_wait_until(intended);
+            p.put_ns = intended;
+        } else {
+            p.put_ns = bench_now_ns();
+        }
+
+        slot.try_put(p);
+        ++res.puts;
+
+        if (!cfg.workload && cfg.put_interval_ns) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(cfg.put_interval_ns));
+        }
+
+        now = bench_now_ns();
+    }
+
+    stop.store(true);
+    consumer.join();
+
+    res.seconds = (bench_now_ns() - start) / 1e9;
+    res.has_energy = rapl.available();
+    res.joules = res.has_energy ? rapl.stop() : 0;
+    res.p50_ns = stats.percentile(50);
+    res.p99_ns = stats.percentile(99);
+    res.p999_ns = stats.percentile(99.9);
+    res.max_ns = stats.percentile(100);
+
+    return res;
+}
+
+/**
+ * Run one producer and one consumer over a slot for cfg.seconds, measuring how long the consumer
+ * takes to copy a value out while holding the read lock. The producer refills the payload before every put, so the consumer
+ * always copies lines freshly written by the other core. Reported as handoff latencies.
+ */
+template <typename Slot, typename Payload>
+BenchResult run_copy_latency(Slot &slot, const BenchConfig &cfg) {
+    std::atomic<bool> stop{false};
+    LatencyStats stats{cfg.max_samples};
+    BenchResult res;
+
+    std::thread consumer([&] () {
+        pin_this_thread(cfg.consumer_cpu);
+
+        Payload p;
+        auto lock = slot.get_lock();
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            // the state handshake is left out, only the copy is timed
+            if (lock.try_lock()) {
+                const uint64_t start = bench_now_ns();
+                p = *lock.read();
+                bench_keep(p);
+                stats.add(bench_now_ns() - start);
+
+                lock.unlock();
+                ++res.handoffs;
+            }
+        }
+    });
+
+    ScopedPin pin{cfg.producer_cpu};
+    Payload p{};
+
+    const uint64_t start = bench_now_ns();
+    const uint64_t end = start + static_cast<uint64_t>(cfg.seconds * 1e9);
+
+    while (bench_now_ns() < end) {
+        p.seq = res.puts + 1;
+        bench_fill(p, sizeof(p));
+        p.put_ns = bench_now_ns();
+
+        slot.try_put(p);
+        ++res.puts;
+
+        if (cfg.put_interval_ns) {
+            bench_wait_until(bench_now_ns() + cfg.put_interval_ns);
+        }
+    }
+
+    stop.store(true);
+    consumer.join();
+
+    res.seconds = (bench_now_ns() - start) / 1e9;
+    res.p50_ns = stats.percentile(50);
+    res.p99_ns = stats.percentile(99);
+    res.p999_ns = stats.percentile(99.9);
+    res.max_ns = stats.percentile(100);
+
+    return res;
+}
+
+/**
+ * Pick the producer and consumer CPUs: "auto" takes the closest isolated pair, or the closest pair
+ * of any usable CPUs if fewer than two are isolated, "none" leaves the threads unpinned, "P,C" pins as given.
+ * The choice is printed as a comment line.
+ *
+ * \param description receives the printed choice if not \c nullptr
+ * \returns \c false if the spec is malformed
+ */
+inline bool make_placement(const char *spec, BenchConfig &cfg, std::string *description = nullptr) {
+    char desc[128];
+
+    if (!strcmp(spec, "none")) {
+        snprintf(desc, sizeof(desc), "none");
+    } else if (sscanf(spec, "%d,%d", &cfg.producer_cpu, &cfg.consumer_cpu) == 2) {
+        if (cfg.producer_cpu < 0 || cfg.consumer_cpu < 0) {
+            return false;
+        }
+
+        snprintf(desc, sizeof(desc), "producer cpu %d, consumer cpu %d (%s)", cfg.producer_cpu, cfg.consumer_cpu,
+                 locality_name(CpuTopology{}.locality(cfg.producer_cpu, cfg.consumer_cpu)));
+    } else if (!strcmp(spec, "auto")) {
+        const CpuTopology topology;
+        PlacementOptions opts;
+        CpuPair pair = topology.propose_pair(opts);
+
+        if (!pair.valid()) {
+            opts.isolated_only = false;
+            pair = topology.propose_pair(opts);
+        }
+
+        if (pair.valid()) {
+            cfg.producer_cpu = pair.producer;
+            cfg.consumer_cpu = pair.consumer;
+            snprintf(desc, sizeof(desc), "producer cpu %d, consumer cpu %d (%s%s)", pair.producer, pair.consumer,
+                     locality_name(pair.locality), opts.isolated_only ? ", isolated" : "");
+        } else {
+            snprintf(desc, sizeof(desc), "none, fewer than two usable CPUs");
+        }
+    } else {
+        return false;
+    }
+
+    printf("# placement: %s\n", desc);
+
+    if (description) {
+        *description = desc;
+    }
+
+    return true;
+}
+
+inline void print_result_header() {
+    printf("%-24s %12s %10s %10s %10s %10s %12s %14s %10s\n",
+           "case", "handoffs", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "Mhandoff/s", "J/Mhandoff", "avg W");
+}
+
+inline void print_result(const char *name, const BenchResult &r) {
+    printf("%-24s %12llu %10llu %10llu %10llu %10llu %12.3f ",
+           name, r.handoffs, (unsigned long long)r.p50_ns, (unsigned long long)r.p99_ns,
+           (unsigned long long)r.p999_ns, (unsigned long long)r.max_ns, r.handoffs / r.seconds / 1e6);
+
+    if (r.has_energy && r.handoffs) {
+        printf("%14.3f %10.2f\n", r.joules / (r.handoffs / 1e6), r.joules / r.seconds);
+    } else {
+        printf("%14s %10s\n", "n/a", "n/a");
+    }
+}
@@ -0,0 +1,294 @@
+#include "adaptive_disposable.h"
+#include "antagonists.h"
+#include "bench.h"
+#include "disposable.h"
+#include "disposable_table.h"
+#include "layout.h"
+#include "triple_buffer.h"
+#include "wait_any.h"
+#include "yielders.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utility>
+
+using Payload = BenchPayload<64>;
+
+template <typename Yielder>
+void bench_wait_strategy(const BenchConfig &cfg) {
+  Disposable<Payload, Yielder> slot{Yielder{}};
+
+  const BenchResult r = run_handoff<decltype(slot), Payload>(slot, Yielder{}, cfg);
+  print_result(Yielder::NAME, r);
+}
+
+// Consumer parked on the state word until a put fills the storage
+void bench_futex_wait(const BenchConfig &cfg) {
+  Disposable<Payload, ThreadYielder> slot{ThreadYielder{}};
+
+  // bounded, so that the consumer notices the end of the run
+  const BenchResult r = run_handoff<decltype(slot), Payload>(slot, [&slot] () { wait_any_for(1000000, slot); }, cfg);
+  print_result("futex", r);
+}
+
+// Latency and energy per handoff of every wait strategy
+void bench_energy(const BenchConfig &cfg) {
+  if (!RaplMeter{}.available()) {
+    printf("# RAPL energy counters are not readable, energy columns are n/a\n");
+  }
+
+  print_result_header();
+  bench_wait_strategy<SpinYielder>(cfg);
+  bench_wait_strategy<ThreadYielder>(cfg);
+  bench_wait_strategy<TpauseYielder>(cfg);
+  bench_wait_strategy<ParkYielder>(cfg);
+  bench_futex_wait(cfg);
+}
+
+template <typename Layout, typename... Args>
+void bench_noisy_case(const char *engine, const BenchConfig &cfg, const AntagonistConfig &acfg, Args &&... args) {
+  std::unique_ptr<Layout> l{new Layout{std::forward<Args>(args)...}};
+  Antagonists antagonists;
+
+  antagonists.start(acfg, &l->neighbor);
+  const BenchResult r = run_handoff<typename Layout::SlotType, Payload>(l->slot, ThreadYielder{}, cfg);
+  antagonists.stop();
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s/%s", engine, Layout::NAME);
+  print_result(name, r);
+}
+
+template <template <typename> class Layout>
+void bench_noisy_layout(const BenchConfig &cfg, const AntagonistConfig &acfg) {
+  bench_noisy_case<Layout<Disposable<Payload, ThreadYielder>>>("lock-copy", cfg, acfg, ThreadYielder{});
+  bench_noisy_case<Layout<TripleBuffer<Payload>>>("triple-buffer", cfg, acfg);
+  bench_noisy_case<Layout<AdaptiveDisposable<Payload, ThreadYielder>>>("adaptive", cfg, acfg, ThreadYielder{});
+}
+
+// Handoff latency of every engine and layout while antagonist threads interfere
+void bench_noisy(const BenchConfig &cfg, AntagonistConfig acfg) {
+  if (!acfg.total()) {
+    acfg.streamers = acfg.thrashers = acfg.false_sharers = 1;
+  }
+
+  printf("# antagonists: %u streamers (%zu MiB), %u thrashers (%zu MiB), %u false sharers\n",
+         acfg.streamers, acfg.stream_bytes >> 20, acfg.thrashers, acfg.thrash_bytes >> 20, acfg.false_sharers);
+
+  print_result_header();
+  bench_noisy_layout<PackedLayout>(cfg, acfg);
+  bench_noisy_layout<PaddedLayout>(cfg, acfg);
+}
+
+struct WorkloadSpec {
+  const char *arrivals = "mmpp:1000,1000000,5000000,100000";
+  const char *sizes = "lognormal:256,1.0,65536";
+};
+
+// every case replays the same arrivals and sizes
+bool make_workload(const WorkloadSpec &spec, Workload &ret) {
+  ret.arrivals = make_arrivals(spec.arrivals);
+
+  return ret.arrivals && make_sizes(spec.sizes, ret.sizes);
+}
+
+template <typename Slot, typename... Args>
+void bench_workload_case(const char *engine, BenchConfig cfg, const WorkloadSpec &spec, Args &&... args) {
+  Workload workload;
+  make_workload(spec, workload);
+
+  std::unique_ptr<Slot> slot{new Slot{std::forward<Args>(args)...}};
+  cfg.workload = &workload;
+
+  const BenchResult r = run_handoff<Slot, BenchVarPayload>(*slot, ThreadYielder{}, cfg);
+  print_result(engine, r);
+}
+
+// Open-loop latency of every engine under bursty arrivals with variable payload sizes
+bool bench_workload(const BenchConfig &cfg, const WorkloadSpec &spec) {
+  Workload check;
+
+  if (!make_workload(spec, check)) {
+    fprintf(stderr, "Invalid workload: --arrivals %s --sizes %s\n", spec.arrivals, spec.sizes);
+    return false;
+  }
+
+  printf("# arrivals %s, sizes %s, latency from intended arrival time\n", spec.arrivals, spec.sizes);
+
+  print_result_header();
+  bench_workload_case<Disposable<BenchVarPayload, ThreadYielder>>("lock-copy", cfg, spec, ThreadYielder{});
+  bench_workload_case<TripleBuffer<BenchVarPayload>>("triple-buffer", cfg, spec);
+  bench_workload_case<AdaptiveDisposable<BenchVarPayload, ThreadYielder>>("adaptive", cfg, spec, ThreadYielder{});
+
+  return true;
+}
+
+template <size_t size>
+void bench_demote_size(const BenchConfig &cfg) {
+  using Sized = BenchPayload<size>;
+
+  for (bool demote : {false, true}) {
+    std::unique_ptr<Disposable<Sized, SpinYielder>> slot{new Disposable<Sized, SpinYielder>{SpinYielder{}}};
+    slot->set_demote_on_publish(demote);
+
+    const BenchResult r = run_copy_latency<Disposable<Sized, SpinYielder>, Sized>(*slot, cfg);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%zuB/%s", size, demote ? "cldemote" : "plain");
+    print_result(name, r);
+  }
+}
+
+// Consumer copy latency of fresh values with and without CLDEMOTE on publish
+void bench_demote(const BenchConfig &cfg) {
+  if (!CpuFeatures::get().cldemote()) {
+    printf("# CLDEMOTE is not supported, both variants are plain\n");
+  }
+
+  if (cfg.producer_cpu < 0 || cfg.producer_cpu == cfg.consumer_cpu) {
+    printf("# producer and consumer don't run on separate CPUs, the numbers are meaningless\n");
+  }
+
+  printf("# latency is the time the consumer takes to copy a fresh value out\n");
+
+  print_result_header();
+  bench_demote_size<64>(cfg);
+  bench_demote_size<256>(cfg);
+  bench_demote_size<1024>(cfg);
+  bench_demote_size<4096>(cfg);
+}
+
+// Time to ready of a table restored from a snapshot by a growing number of threads
+bool bench_bulk_load(size_t slots) {
+  using Table = DisposableTable<Payload, ThreadYielder>;
+
+  static constexpr const char *PATH = "/tmp/disposable_bench.snap";
+
+  {
+    std::unique_ptr<Table> table{new Table{ThreadYielder{}, slots}};
+    Payload p{};
+
+    for (size_t i = 0; i < slots; ++i) {
+      p.seq = i + 1;
+      table->try_put(i, p);
+    }
+
+    if (!table->write_snapshot(PATH)) {
+      fprintf(stderr, "Can't write %s\n", PATH);
+      return false;
+    }
+  }
+
+  const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+
+  printf("# %zu slots of %zu bytes\n", slots, sizeof(Payload));
+  printf("%-24s %12s %12s\n", "threads", "ms", "Mslot/s");
+
+  for (unsigned threads = 1;; threads = std::min(threads * 2, cpus)) {
+    std::unique_ptr<Table> table{new Table{ThreadYielder{}, slots}};
+
+    const uint64_t start = bench_now_ns();
+    const bool ok = table->bulk_load(PATH, threads);
+    const double seconds = (bench_now_ns() - start) / 1e9;
+
+    if (!ok) {
+      fprintf(stderr, "Can't load %s\n", PATH);
+      break;
+    }
+
+    printf("%-24u %12.2f %12.3f\n", threads, seconds * 1e3, slots / seconds / 1e6);
+
+    if (threads == cpus) {
+      break;
+    }
+  }
+
+  unlink(PATH);
+
+  return true;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [mode] [--seconds S] [--interval-ns N]\n"
+          "          [--streamers N] [--stream-mb M] [--thrashers N] [--thrash-mb M] [--false-sharers N]\n"
+          "          [--arrivals SPEC] [--sizes SPEC] [--placement auto|none|P,C]\n"
+          "          [--slots N]\n"
+          "Modes:\n"
+          "  energy   latency and RAPL energy per wait strategy (default)\n"
+          "  noisy    latency per engine and layout under antagonist threads, one of each by default\n"
+          "  workload open-loop latency per engine under generated arrivals, see workload.h for specs\n"
+          "  demote   consumer copy latency per payload size with and without CLDEMOTE on publish\n"
+          "  bulkload time to restore a table of slots from a snapshot per number of loader threads\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  BenchConfig cfg;
+  AntagonistConfig acfg;
+  WorkloadSpec wspec;
+  const char *mode = "energy";
+  const char *placement = "auto";
+  size_t slots = 1 << 18;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      cfg.seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--interval-ns") && i + 1 < argc) {
+      cfg.put_interval_ns = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--streamers") && i + 1 < argc) {
+      acfg.streamers = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--stream-mb") && i + 1 < argc) {
+      acfg.stream_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+    } else if (!strcmp(argv[i], "--thrashers") && i + 1 < argc) {
+      acfg.thrashers = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--thrash-mb") && i + 1 < argc) {
+      acfg.thrash_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+    } else if (!strcmp(argv[i], "--false-sharers") && i + 1 < argc) {
+      acfg.false_sharers = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--arrivals") && i + 1 < argc) {
+      wspec.arrivals = argv[++i];
+    } else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+      wspec.sizes = argv[++i];
+    } else if (!strcmp(argv[i], "--slots") && i + 1 < argc) {
+      slots = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "--placement") && i + 1 < argc) {
+      placement = argv[++i];
+    } else if (argv[i][0] != '-') {
+      mode = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!make_placement(placement, cfg)) {
+    fprintf(stderr, "Invalid placement: %s\n", placement);
+    return 2;
+  }
+
+  if (!strcmp(mode, "energy")) {
+    bench_energy(cfg);
+  } else if (!strcmp(mode, "noisy")) {
+    bench_noisy(cfg, acfg);
+  } else if (!strcmp(mode, "workload")) {
+    if (!bench_workload(cfg, wspec)) {
+      return 2;
+    }
+  } else if (!strcmp(mode, "demote")) {
+    bench_demote(cfg);
+  } else if (!strcmp(mode, "bulkload")) {
+    if (!bench_bulk_load(slots)) {
+      return 1;
+    }
+  } else {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#include "cpu_features.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma once
+
+/**
+ * Cache hints for data handed over to another core.
+ */
+
+static constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * Hint the CPU to move the lines covering [p, p + size) from the private caches to the shared
+ * last level cache with CLDEMOTE, so that another core reading them soon doesn't have to snoop
+ * them out of this core. Does nothing on CPUs without CLDEMOTE.
+ */
+inline void demote_lines(const void *p, size_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (!CpuFeatures::get().cldemote() || !size) {
+        return;
+    }
+
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(p) & ~(CACHE_LINE_SIZE - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(p) + size;
+
+    for (uintptr_t line = begin; line < end; line += CACHE_LINE_SIZE) {
+        // cldemote (%rax), encoded manually to avoid requiring -mcldemote
+        asm volatile(".byte 0x0f, 0x1c, 0x00" : : "a"(line) : "memory");
+    }
+#else
+    (void)p;
+    (void)size;
+#endif
+}
@@ -0,0 +1,129 @@
+#include <assert.h>
+#include <atomic>
+#include <stdint.h>
+#include <type_traits>
+
+#pragma once
+
+/**
+ * Latest-value storage shared by several competing consumers.
+ * Every published value is handed to at most one consumer, unread values are overwritten by newer ones.
+ *
+ * The slot is a pair of buffers and a single state word holding the publish sequence number,
+ * the index of the published buffer and a claimed flag. A consumer copies the published buffer
+ * optimistically and then claims it by setting the flag with CAS against the word it copied from.
+ * The CAS fails if a peer claimed the value first or if the producer republished meanwhile,
+ * in which case the copy may be torn and is discarded. That's why T has to be trivially copyable.
+ *
+ * Claims are fair: a consumer which has just claimed a value yields its next attempt
+ * to peers which keep finding the slot empty.
+ *
+ * It's assumed that there's only one Producer and up to MAX_WORKERS Consumers with distinct ids.
+ */
+template <typename T, typename YieldF = void (*)(), unsigned int block_retries = 2>
+class CompetingDisposable {
+public:
+    using Type = T;
+    using Yielder = YieldF;
+    static constexpr unsigned int BLOCK_RETRIES = block_retries;
+    static constexpr unsigned int MAX_WORKERS = 64;
+
+    static_assert(std::is_trivially_copyable<T>::value, "Optimistic copies require trivially copyable type");
+
+    CompetingDisposable(Yielder &&yield) : _word{CLAIMED_MASK}, _hungry{0}, _yield{yield} {}
+
+    /**
+     * Non-blocking claim and copy.
+     * The value is consumed by this worker only.
+     *
+     * \param ret target memory location to copy into, left untouched unless a value was claimed
+     * \param worker id of the calling consumer, less than MAX_WORKERS
+     * \returns \c true if a value was claimed, \c false if there was no unclaimed value or the claim kept losing races.
+     */
+    bool try_claim_into(T &ret, unsigned worker) {
+        assert(worker < MAX_WORKERS && "Invalid worker id");
+
+        const uint64_t self = uint64_t{1} << worker;
+        const uint64_t hungry = _hungry.load(std::memory_order_relaxed);
+
+        // just served, let the waiting peers go first
+        if (!(hungry & self) && (hungry & ~self)) {
+            _hungry.fetch_or(self, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto word = _word.load(std::memory_order_acquire);
+        unsigned retries_left = BLOCK_RETRIES;
+
+        do {
+            if (word & CLAIMED_MASK) {
+                if (!(hungry & self)) {
+                    _hungry.fetch_or(self, std::memory_order_relaxed);
+                }
+
+                return false;
+            }
+
+            // the copy may be torn, the caller gets it only once the claim proves it isn't
+            const T copy = _buffers[(word & INDEX_MASK) >> INDEX_SHIFT];
+
+            // release keeps the copy above the claim
+            if (_word.compare_exchange_strong(word, word | CLAIMED_MASK, std::memory_order_acq_rel,
+                                              std::memory_order_acquire)) {
+                ret = copy;
+
+                if (hungry & self) {
+                    _hungry.fetch_and(~self, std::memory_order_relaxed);
+                }
+
+                return true;
+            }
+
+            _yield();
+
+            word = _word.load(std::memory_order_acquire);
+        } while (retries_left-- != 0);
+
+        return false;
+    }
+
+    /**
+     * Wait-free write.
+     * An unclaimed value is overwritten.
+     *
+     * \param v value to store
+     * \returns always \c true, kept for interface compatibility with Disposable
+     */
+    bool try_put(const T &v) {
+        _buffers[_back] = v;
+
+        const uint64_t word = (++_seq << SEQ_SHIFT) | (uint64_t{_back} << INDEX_SHIFT);
+        const auto prev = _word.exchange(word, std::memory_order_acq_rel);
+
+        _back = (prev & INDEX_MASK) >> INDEX_SHIFT;
+        _overwritten += !(prev & CLAIMED_MASK);
+
+        return true;
+    }
+
+    // Number of values overwritten before any consumer claimed them, producer side only
+    unsigned long long overwritten() const { return _overwritten; }
+
+protected:
+    static constexpr uint64_t CLAIMED_MASK = 1;
+    static constexpr uint64_t INDEX_MASK = 2;
+    static constexpr unsigned INDEX_SHIFT = 1;
+    static constexpr unsigned SEQ_SHIFT = 2;
+
+    Type _buffers[2];
+
+    alignas(64) std::atomic<uint64_t> _word;
+    alignas(64) std::atomic<uint64_t> _hungry;
+
+    // producer side only
+    alignas(64) uint64_t _seq = 0;
+    unsigned _back = 1;
+    unsigned long long _overwritten = 0;
+
+    Yielder _yield;
+};
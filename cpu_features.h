@@ -0,0 +1,38 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#pragma once
+
+/**
+ * Runtime detection of optional CPU instructions.
+ * Everything reports \c false on other architectures.
+ */
+class CpuFeatures {
+public:
+    static const CpuFeatures &get() {
+        static const CpuFeatures features;
+        return features;
+    }
+
+    // TPAUSE, UMONITOR and UMWAIT
+    bool waitpkg() const { return _waitpkg; }
+
+    // CLDEMOTE
+    bool cldemote() const { return _cldemote; }
+
+private:
+    bool _waitpkg = false;
+    bool _cldemote = false;
+
+    CpuFeatures() {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned eax, ebx, ecx, edx;
+
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            _waitpkg = ecx & (1u << 5);
+            _cldemote = ecx & (1u << 25);
+        }
+#endif
+    }
+};
@@ -1,9 +1,21 @@
+#include "cache_hints.h"
+#include "futex.h"
+#include "warm_up.h"
+
 #include <assert.h>
 #include <atomic>
+#include <chrono>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
 
 #pragma once
 
+// Access to the state words for waiting on slots, see wait_any.h
+struct DisposableWaitAccess;
+
 /**
  * The class implements a storage for single time-read after the latest write.
  * This class is non-blocking and thread safe.
@@ -17,6 +29,28 @@ public:
     static constexpr unsigned int BLOCK_RETRIES = block_retries;
     using Self = Disposable<Type, Yielder, BLOCK_RETRIES>;
 
+    /**
+     * Tells whether the producer has published since a read, see token().
+     * Copyable and usable from any thread while the slot is alive.
+     */
+    class StalenessToken {
+    public:
+        StalenessToken() = default;
+
+        // A single relaxed load of the producer's publish counter
+        bool stale() const {
+            return _seq && _seq->load(std::memory_order_relaxed) != _read_seq;
+        }
+
+    private:
+        friend Self;
+
+        const std::atomic<uint64_t> *_seq = nullptr;
+        uint64_t _read_seq = 0;
+
+        StalenessToken(const std::atomic<uint64_t> &seq, uint64_t read_seq) : _seq{&seq}, _read_seq{read_seq} {}
+    };
+
     /**
      * Lock class. Implements RAII if required.
      * May be used in a way similar to unique_lock also.
@@ -45,6 +79,7 @@ public:
         bool try_lock() {
             if (_host._try_block_for_read()) {
                 _ptr = &_host._storage;
+                _host._note_read();
             }
 
             return _ptr;
@@ -57,6 +92,14 @@ public:
             }
         }
 
+        /**
+         * Whether the producer has failed to write while the lock was held.
+         * Cooperative consumers may copy what they need and unlock early.
+         */
+        bool writer_waiting() const {
+            return _host._state.load(std::memory_order_relaxed) & STATE_WRITER_PENDING_MASK;
+        }
+
         bool is_locked() const { return _ptr; }
         PtrT read() const { return _ptr; }
         operator PtrT () const { return read(); }
@@ -64,7 +107,17 @@ public:
         operator bool() const { return is_locked(); }
     };
 
-    Disposable(Yielder &&yield) : _state{STATE_STORAGE_EMPTY_MASK}, _yield{yield} {}
+    Disposable(Yielder &&yield) : _state{STATE_STORAGE_EMPTY_MASK}, _yield{yield} {
+        static_assert(_state_block_shared(), "The publish sequence has to share the line of the state word");
+    }
+
+    // Construct the storage in place from args, e.g. with an allocator, see ArenaDisposable
+    template <typename... Args>
+    Disposable(Yielder &&yield, std::in_place_t, Args &&... args)
+        : _state{STATE_STORAGE_EMPTY_MASK}, _storage(std::forward<Args>(args)...), _yield{yield}
+    {
+        static_assert(_state_block_shared(), "The publish sequence has to share the line of the state word");
+    }
 
     // Returns an unlocked version of read lock
     ReadLock get_lock() {
@@ -89,6 +142,7 @@ public:
     bool try_read_into(T &ret) {
         if (_try_block_for_read()) {
             ret = _storage;
+            _note_read();
 
             _unblock_after_read_and_empty_storage();
 
@@ -108,7 +162,10 @@ public:
         if (_try_block_for_write()) {
             _storage = v;
 
+            _demote_storage();
+            _bump_publish_seq();
             _unblock_after_write_and_fill_storage();
+            _published = true;
 
             return true;
         }
@@ -116,17 +173,146 @@ public:
         return false;
     }
 
+    /**
+     * Non-blocking write which skips values equal to the last published one.
+     * Skipped values don't touch the state, so the consumer isn't bothered with them.
+     * Trivially copyable values are compared bytewise, others with operator==.
+     *
+     * \param v value to store
+     * \returns \c true if write was successfull or skipped, \c false if the operation was blocked by simultaneous read
+     */
+    bool try_put_if_changed(const T &v) {
+        return try_put_if_changed(v, &_equal_values);
+    }
+
+    /**
+     * Non-blocking write which skips values equal to the last published one.
+     *
+     * \param v value to store
+     * \param equal comparator called as equal(last_published, v)
+     * \returns \c true if write was successfull or skipped, \c false if the operation was blocked by simultaneous read
+     */
+    template <typename Equal>
+    bool try_put_if_changed(const T &v, Equal &&equal) {
+        return _skip_unchanged(v, equal) || try_put(v);
+    }
+
+    /**
+     * Prepare the storage for the first real updates: run dummy handoffs from the intended producer
+     * and consumer CPUs, so that the state and storage lines, TLB entries and branch predictors are warm.
+     * With opts.lock_memory the pages of the object are faulted in and locked first and stay locked,
+     * see warm_up_memory and release_memory; memory owned by T outside the object isn't locked.
+     * Must not run concurrently with any other operation. The storage is empty afterwards
+     * and the statistics are reset.
+     *
+     * \returns \c false if the memory couldn't be locked, the handoffs are run anyway
+     */
+    bool warm_up(const WarmUpOptions &opts = WarmUpOptions{}) {
+        const bool locked = !opts.lock_memory || warm_up_memory(this, sizeof(*this));
+        Self *self = this;
+
+        warm_up_handoffs(&self, 1, opts);
+        _reset_after_warm_up();
+
+        return locked;
+    }
+
+    /**
+     * Whether a value newer than the last one read has been published since.
+     * Consumer side only.
+     */
+    bool newer_available() const {
+        return _publish_seq.load(std::memory_order_relaxed) != _read_seq;
+    }
+
+    /**
+     * Token of the last value read, which becomes stale once the producer publishes again.
+     * Long computations on the value may poll it and give up early. Consumer side only.
+     */
+    StalenessToken token() const {
+        return StalenessToken{_publish_seq, _read_seq};
+    }
+
+    /**
+     * Push the storage lines towards the shared cache after every write, before the consumer
+     * is signalled, see demote_lines. Memory owned by T outside the object isn't demoted.
+     * Producer side only.
+     *
+     * \returns \c true if enabled and supported by the CPU
+     */
+    bool set_demote_on_publish(bool on) {
+        _demote_on_publish = on && CpuFeatures::get().cldemote();
+        return _demote_on_publish;
+    }
+
+    // Number of puts skipped by try_put_if_changed
+    unsigned long long suppressed_puts() const {
+        return _suppressed_puts.load(std::memory_order_relaxed);
+    }
+
+    struct WriterWaitStats {
+        // write attempts which found the storage blocked for read
+        unsigned long long waits;
+        uint64_t total_ns;
+        uint64_t max_ns;
+    };
+
+    // Time the producer spent retrying while the consumer held the storage
+    WriterWaitStats writer_wait_stats() const {
+        return WriterWaitStats{_writer_waits.load(std::memory_order_relaxed),
+                               _writer_wait_total_ns.load(std::memory_order_relaxed),
+                               _writer_wait_max_ns.load(std::memory_order_relaxed)};
+    }
+
 protected:
-    using StateType = uint16_t;
+    friend DisposableWaitAccess;
+
+    // 32 bits wide to be usable as a futex
+    using StateType = uint32_t;
+
+    // the state word and the publish sequence form a 16 byte block which never straddles a line,
+    // so puts, reads and newer_available don't touch a line of their own for the sequence
+    alignas(16) std::atomic<StateType> _state;
+
+    // signalled publishes, written by the producer while blocked for write
+    std::atomic<uint64_t> _publish_seq{0};
 
     Type _storage;
 
-    std::atomic<StateType> _state;
+    // consumer side only, publish sequence of the last value read
+    uint64_t _read_seq = 0;
+
     Yielder _yield;
 
+    // producer side only
+    bool _published = false;
+    bool _demote_on_publish = false;
+    std::atomic<unsigned long long> _suppressed_puts{0};
+    std::atomic<unsigned long long> _writer_waits{0};
+    std::atomic<uint64_t> _writer_wait_total_ns{0};
+    std::atomic<uint64_t> _writer_wait_max_ns{0};
+
     static constexpr StateType STATE_STORAGE_EMPTY_MASK = 1;
     static constexpr StateType STATE_READ_BLOCK_MASK = 2;
     static constexpr StateType STATE_WRITE_BLOCK_MASK = 4;
+    // set by a write attempt which found the storage blocked for read, cleared by the next successful one
+    static constexpr StateType STATE_WRITER_PENDING_MASK = 8;
+    // set by a consumer going to sleep on the state, cleared by the write which fills the storage and wakes it
+    static constexpr StateType STATE_WAITERS_MASK = 16;
+
+    // T may make the class non standard layout, GCC and Clang support offsetof on it nonetheless
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+    static constexpr bool _state_block_shared() {
+        return offsetof(Disposable, _state) % 16 == 0 &&
+               offsetof(Disposable, _publish_seq) + sizeof(_publish_seq) <= offsetof(Disposable, _state) + 16;
+    }
+#pragma GCC diagnostic pop
+
+    static uint64_t _now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
     inline StateType _clear_state_mask(StateType orig, StateType mask) {
         return orig & (~mask);
@@ -137,7 +323,8 @@ protected:
     }
 
     // block for read if and only if the storage isn't empty and there's no write operation taking place at the moment
-    bool _try_block_for_read() {
+    // write_blocked is set if an attempt found a write in progress, an empty storage alone doesn't count
+    bool _try_block_for_read(bool *write_blocked = nullptr) {
         auto expected = _state.load();
         expected = _clear_state_mask(expected, STATE_WRITE_BLOCK_MASK | STATE_STORAGE_EMPTY_MASK);
         auto desired = _set_state_mask(expected, STATE_READ_BLOCK_MASK);
@@ -152,6 +339,11 @@ protected:
                 break;
             }
 
+            // the failed exchange left the actual state in expected
+            if (write_blocked && (expected & STATE_WRITE_BLOCK_MASK)) {
+                *write_blocked = true;
+            }
+
             _yield();
 
             expected = _state.load();
@@ -165,19 +357,37 @@ protected:
     // should only be called after a successfull _try_block_for_read
     void _unblock_after_read_and_empty_storage() {
         auto expected = _state.load();
-        auto desired = _clear_state_mask(expected, STATE_READ_BLOCK_MASK);
-        desired = _set_state_mask(desired, STATE_STORAGE_EMPTY_MASK);
+        StateType desired;
+
+        // the producer may raise the pending flag meanwhile
+        do {
+            assert((expected & STATE_READ_BLOCK_MASK) && "Invalid read lock");
+
+            desired = _clear_state_mask(expected, STATE_READ_BLOCK_MASK);
+            desired = _set_state_mask(desired, STATE_STORAGE_EMPTY_MASK);
+        } while (!_state.compare_exchange_weak(expected, desired));
+    }
+
+    // give the read lock back without consuming the value
+    void _unblock_after_read_keep_storage_state() {
+        auto expected = _state.load();
+        StateType desired;
+
+        do {
+            assert((expected & STATE_READ_BLOCK_MASK) && "Invalid read lock");
 
-        bool rc = _state.compare_exchange_strong(expected, desired);
-        assert(rc && "Invalid read lock");
+            desired = _clear_state_mask(expected, STATE_READ_BLOCK_MASK);
+        } while (!_state.compare_exchange_weak(expected, desired));
     }
 
     // block for write if and only if the storage isn't blocked for read
-    bool _try_block_for_write() {
+    // retries_used receives the number of yields spent before the outcome, BLOCK_RETRIES + 1 on failure
+    bool _try_block_for_write(unsigned *retries_used = nullptr) {
         auto expected = _clear_state_mask(_state.load(), STATE_READ_BLOCK_MASK);
-        auto desired = _set_state_mask(expected, STATE_WRITE_BLOCK_MASK);
+        auto desired = _set_state_mask(_clear_state_mask(expected, STATE_WRITER_PENDING_MASK), STATE_WRITE_BLOCK_MASK);
 
         unsigned retries_left = BLOCK_RETRIES;
+        uint64_t wait_started_ns = 0;
         bool ret = true;
 
         do {
@@ -187,21 +397,115 @@ protected:
                 break;
             }
 
+            // let the consumer know, unless it was a spurious failure
+            if (!wait_started_ns && (expected & STATE_READ_BLOCK_MASK)) {
+                wait_started_ns = _now_ns();
+                _state.fetch_or(STATE_WRITER_PENDING_MASK);
+            }
+
             _yield();
 
             expected = _clear_state_mask(_state.load(), STATE_READ_BLOCK_MASK);
-            desired = _set_state_mask(expected, STATE_WRITE_BLOCK_MASK);
+            desired = _set_state_mask(_clear_state_mask(expected, STATE_WRITER_PENDING_MASK), STATE_WRITE_BLOCK_MASK);
         } while (retries_left-- != 0);
 
+        if (retries_used) {
+            *retries_used = BLOCK_RETRIES - retries_left;
+        }
+
+        if (wait_started_ns) {
+            _account_writer_wait(_now_ns() - wait_started_ns);
+        }
+
         return ret;
     }
 
-    // called only after successful _try_block_for_write
+    // producer side only, while blocked for write
+    void _demote_storage() {
+        if (_demote_on_publish) {
+            demote_lines(&_storage, sizeof(_storage));
+        }
+    }
+
+    // producer side only, while blocked for write and before the storage is filled
+    void _bump_publish_seq() {
+        _publish_seq.store(_publish_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // consumer side only, while blocked for read
+    void _note_read() {
+        _read_seq = _publish_seq.load(std::memory_order_relaxed);
+    }
+
+    // after the dummy handoffs of warm_up, no other operation may run concurrently
+    void _reset_after_warm_up() {
+        _published = false;
+        _read_seq = _publish_seq.load();
+        _suppressed_puts.store(0);
+        _writer_waits.store(0);
+        _writer_wait_total_ns.store(0);
+        _writer_wait_max_ns.store(0);
+    }
+
+    static bool _equal_values(const T &a, const T &b) {
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            return !memcmp(&a, &b, sizeof(T));
+        } else {
+            return a == b;
+        }
+    }
+
+    // producer side only, whether v equals the last published value and the put is to be skipped
+    template <typename Equal>
+    bool _skip_unchanged(const T &v, Equal &equal) {
+        // only the producer writes the storage, so reading it concurrently with the consumer is safe
+        if (_published && equal(static_cast<const T &>(_storage), v)) {
+            _suppressed_puts.store(_suppressed_puts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
+    // producer side only
+    void _account_writer_wait(uint64_t ns) {
+        _writer_waits.store(_writer_waits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        _writer_wait_total_ns.store(_writer_wait_total_ns.load(std::memory_order_relaxed) + ns,
+                                    std::memory_order_relaxed);
+
+        if (ns > _writer_wait_max_ns.load(std::memory_order_relaxed)) {
+            _writer_wait_max_ns.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    // called only after successful _try_block_for_write, wakes the consumer if it's waiting
     void _unblock_after_write_and_fill_storage() {
         auto expected = _state.load();
-        const auto desired = _clear_state_mask(expected, STATE_WRITE_BLOCK_MASK | STATE_STORAGE_EMPTY_MASK);
+        StateType desired;
+
+        // the consumer may announce itself meanwhile
+        do {
+            assert((expected & STATE_WRITE_BLOCK_MASK) && "Invalid write lock");
+
+            desired = _clear_state_mask(expected,
+                                        STATE_WRITE_BLOCK_MASK | STATE_STORAGE_EMPTY_MASK | STATE_WAITERS_MASK);
+        } while (!_state.compare_exchange_weak(expected, desired));
+
+        if (expected & STATE_WAITERS_MASK) {
+            futex_wake_all(_state);
+        }
+    }
+
+    // called only after successful _try_block_for_write, leaves the storage empty or filled as it was
+    // and doesn't wake the consumer
+    void _unblock_after_write_keep_storage_state() {
+        auto expected = _state.load();
+        StateType desired;
+
+        do {
+            assert((expected & STATE_WRITE_BLOCK_MASK) && "Invalid write lock");
 
-        bool rc = _state.compare_exchange_strong(expected, desired);
-        assert(rc && "Invalid write lock");
+            desired = _clear_state_mask(expected, STATE_WRITE_BLOCK_MASK);
+        } while (!_state.compare_exchange_weak(expected, desired));
     }
 };
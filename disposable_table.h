@@ -0,0 +1,271 @@
+#include "disposable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#pragma once
+
+/**
+ * Fixed size table of latest-value slots addressed by index, with a snapshot file format
+ * to restore all of them quickly after a restart.
+ *
+ * Snapshot file layout, all columns start at 64 byte boundaries:
+ *   SnapshotHeader
+ *   presence column, one byte per slot, non-zero if the slot holds a value
+ *   value column, size() values stored as is
+ *
+ * bulk_load() maps the file and splits the slots between a pool of threads which fill the storage
+ * directly. Reads of the whole table are held back by a table-level flag until every slot is filled,
+ * so the consumers see the snapshot appear at once.
+ *
+ * Values are stored in the file as is, so they have to be trivially copyable.
+ * It's assumed that there's only one Producer and a single Consumer per slot.
+ */
+template <typename T, typename YieldF = void (*)(), unsigned int block_retries = 2>
+class DisposableTable {
+public:
+    using Type = T;
+    using Yielder = YieldF;
+    static constexpr unsigned int BLOCK_RETRIES = block_retries;
+
+    static_assert(std::is_trivially_copyable<T>::value, "Values are stored in snapshot files");
+
+    struct SnapshotHeader {
+        static constexpr char MAGIC[8] = {'D', 'S', 'P', 'S', 'N', 'A', 'P', '\0'};
+
+        char magic[8];
+        uint64_t count;
+        uint32_t value_size;
+        uint32_t reserved;
+        uint64_t presence_offset;
+        uint64_t values_offset;
+    };
+
+    DisposableTable(Yielder &&yield, size_t size)
+        : _slots{static_cast<Slot *>(::operator new(size * sizeof(Slot), std::align_val_t{alignof(Slot)}))},
+          _size{size}
+    {
+        for (size_t i = 0; i < size; ++i) {
+            new (&_slots[i]) Slot{Yielder{yield}};
+        }
+    }
+
+    DisposableTable(const DisposableTable &) = delete;
+    DisposableTable &operator=(const DisposableTable &) = delete;
+
+    ~DisposableTable() {
+        for (size_t i = 0; i < _size; ++i) {
+            _slots[i].~Slot();
+        }
+
+        ::operator delete(_slots, std::align_val_t{alignof(Slot)});
+    }
+
+    size_t size() const { return _size; }
+
+    /**
+     * Non-blocking write.
+     *
+     * \returns \c true if write was successfull, \c false if the operation was blocked by simultaneous read
+     */
+    bool try_put(size_t id, const T &v) {
+        assert(id < _size && "Invalid slot");
+        return _slots[id].try_put(v);
+    }
+
+    /**
+     * Non-blocking read and copy.
+     * The slot becomes empty on successfull read.
+     *
+     * \returns \c true if copy was successfull, \c false if the read was blocked by simultaneous write,
+     * the slot was empty or a bulk load is in progress
+     */
+    bool try_read_into(size_t id, T &ret) {
+        assert(id < _size && "Invalid slot");
+
+        if (!_ready.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        return _slots[id].try_read_into_if_ready(_ready, ret);
+    }
+
+    // Whether no bulk load is in progress
+    bool ready() const { return _ready.load(std::memory_order_acquire); }
+
+    /**
+     * Write the last published value of every slot into a snapshot file.
+     * Producer side only.
+     *
+     * \returns \c false if the file couldn't be written
+     */
+    bool write_snapshot(const char *path) const {
+        SnapshotHeader h{};
+        memcpy(h.magic, SnapshotHeader::MAGIC, sizeof(h.magic));
+        h.count = _size;
+        h.value_size = sizeof(T);
+        h.presence_offset = _align(sizeof(SnapshotHeader));
+        h.values_offset = _align(h.presence_offset + _size);
+
+        FILE *f = fopen(path, "wb");
+
+        if (!f) {
+            return false;
+        }
+
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+        ok = ok && !fseek(f, h.presence_offset, SEEK_SET);
+
+        for (size_t i = 0; ok && i < _size; ++i) {
+            ok = fputc(_slots[i].published() ? 1 : 0, f) != EOF;
+        }
+
+        ok = ok && !fseek(f, h.values_offset, SEEK_SET);
+
+        for (size_t i = 0; ok && i < _size; ++i) {
+            ok = fwrite(&_slots[i].stored(), sizeof(T), 1, f) == 1;
+        }
+
+        return !fclose(f) && ok;
+    }
+
+    /**
+     * Fill the slots from a snapshot file with a pool of threads, then let the consumers in.
+     * Slots absent from the snapshot are left as they are. Must not run concurrently with puts.
+     * May reload a table which is already in use, reads return \c false from the start of the load
+     * until it's done, so no consumer sees a mix of old and loaded slots.
+     *
+     * \param threads size of the pool, 0 for one per CPU
+     * \returns \c false if the file couldn't be mapped or doesn't match the table; nothing is loaded then
+     */
+    bool bulk_load(const char *path, unsigned threads = 0) {
+        const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        void *p = fstat(fd, &st) ? MAP_FAILED : mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (p == MAP_FAILED) {
+            return false;
+        }
+
+        const unsigned char *map = static_cast<const unsigned char *>(p);
+        SnapshotHeader h;
+        bool ok = static_cast<size_t>(st.st_size) >= sizeof(h);
+
+        if (ok) {
+            memcpy(&h, map, sizeof(h));
+            ok = !memcmp(h.magic, SnapshotHeader::MAGIC, sizeof(h.magic)) && h.value_size == sizeof(T) &&
+                 h.count <= _size && h.presence_offset + h.count <= static_cast<uint64_t>(st.st_size) &&
+                 h.values_offset + h.count * sizeof(T) <= static_cast<uint64_t>(st.st_size);
+        }
+
+        if (ok) {
+            // the advice values are not flags, each has to be given separately
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            madvise(p, st.st_size, MADV_WILLNEED);
+
+            if (!threads) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            threads = static_cast<unsigned>(std::min<uint64_t>(threads, std::max<uint64_t>(1, h.count)));
+
+            const unsigned char *presence = map + h.presence_offset;
+            const unsigned char *values = map + h.values_offset;
+            std::vector<std::thread> pool;
+
+            // the table may already be live: close the gate before any loader can touch a slot,
+            // readers in flight recheck it under the slot's read lock
+            _ready.store(false);
+
+            for (unsigned t = 0; t < threads; ++t) {
+                const size_t begin = h.count * t / threads;
+                const size_t end = h.count * (t + 1) / threads;
+
+                pool.emplace_back([this, presence, values, begin, end] () {
+                    for (size_t i = begin; i < end; ++i) {
+                        if (presence[i]) {
+                            _slots[i].load(values + i * sizeof(T));
+                        }
+                    }
+                });
+            }
+
+            for (auto &t : pool) {
+                t.join();
+            }
+
+            _ready.store(true, std::memory_order_release);
+        }
+
+        munmap(p, st.st_size);
+
+        return ok;
+    }
+
+protected:
+    class Slot : public Disposable<T, YieldF, block_retries> {
+    public:
+        using Base = Disposable<T, YieldF, block_retries>;
+
+        Slot(YieldF &&yield) : Base{std::move(yield)} {}
+
+        // producer side only
+        bool published() const { return this->_published; }
+        const T &stored() const { return this->_storage; }
+
+        // consumer side: a reader which passed the table gate before a bulk load started may only get
+        // to the slot after its loader; the flag is checked again under the read lock, which keeps the
+        // loader out, so such a reader either takes the value from before the load or nothing
+        bool try_read_into_if_ready(const std::atomic<bool> &ready, T &ret) {
+            if (!this->_try_block_for_read()) {
+                return false;
+            }
+
+            if (!ready.load()) {
+                this->_unblock_after_read_keep_storage_state();
+                return false;
+            }
+
+            ret = this->_storage;
+            this->_note_read();
+            this->_unblock_after_read_and_empty_storage();
+
+            return true;
+        }
+
+        // fill the storage from unaligned memory, waiting out a consumer still reading an older value
+        void load(const void *v) {
+            while (!this->_try_block_for_write()) {
+            }
+
+            memcpy(&this->_storage, v, sizeof(T));
+            this->_bump_publish_seq();
+            this->_unblock_after_write_and_fill_storage();
+            this->_published = true;
+        }
+    };
+
+    Slot *_slots;
+    size_t _size;
+
+    alignas(64) std::atomic<bool> _ready{true};
+
+    static uint64_t _align(uint64_t offset) { return (offset + 63) & ~uint64_t{63}; }
+};
@@ -0,0 +1,143 @@
+#include "disposable.h"
+
+#include <atomic>
+#include <utility>
+
+#pragma once
+
+/**
+ * Latest-value storage which signals the consumer only on meaningful changes.
+ *
+ * The predicate is evaluated by the producer on every put as pred(last_delivered, v).
+ * If it holds, the put marks the storage filled as usual. Otherwise the value is stored silently:
+ * an empty storage stays empty and the consumer isn't bothered, a storage still holding an unread
+ * value gets the newer one, which is then the value the consumer is going to receive.
+ * The very first put always signals.
+ *
+ * Since the reference value only changes on delivery, slow drift is signalled as soon as it
+ * accumulates beyond what the predicate tolerates.
+ *
+ * It's assumed that there's only one Producer and a single Consumer.
+ */
+template <typename T, typename Predicate, typename YieldF = void (*)(), unsigned int block_retries = 2>
+class FilteredDisposable : public Disposable<T, YieldF, block_retries> {
+public:
+    using Base = Disposable<T, YieldF, block_retries>;
+    using typename Base::Type;
+    using typename Base::Yielder;
+
+    FilteredDisposable(Yielder &&yield, Predicate pred = Predicate{})
+        : Base{std::move(yield)}, _pred{std::move(pred)}
+    {}
+
+    /**
+     * Non-blocking write, signalling the consumer only if the predicate holds.
+     *
+     * \param v value to store
+     * \param signalled receives whether the consumer is going to get the value, if not \c nullptr
+     * \returns \c true if write was successfull, \c false if the operation was blocked by simultaneous read
+     */
+    bool try_put(const T &v, bool *signalled = nullptr) {
+        const bool signal = !_delivered || _pred(static_cast<const T &>(_last_delivered), v);
+
+        if (!this->_try_block_for_write()) {
+            return false;
+        }
+
+        this->_storage = v;
+        this->_demote_storage();
+
+        // the consumer can't empty the storage while it's blocked for write
+        const bool delivered = signal || !(this->_state.load() & Base::STATE_STORAGE_EMPTY_MASK);
+
+        if (delivered) {
+            this->_bump_publish_seq();
+        }
+
+        if (signal) {
+            this->_unblock_after_write_and_fill_storage();
+        } else {
+            this->_unblock_after_write_keep_storage_state();
+            _silent_puts.store(_silent_puts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        if (delivered) {
+            _last_delivered = v;
+            _delivered = true;
+        }
+
+        this->_published = true;
+
+        if (signalled) {
+            *signalled = delivered;
+        }
+
+        return true;
+    }
+
+    /**
+     * Non-blocking write which skips values equal to the last stored one, see Disposable::try_put_if_changed.
+     * Values which are stored go through the predicate as with try_put.
+     *
+     * \returns \c true if write was successfull or skipped, \c false if the operation was blocked by simultaneous read
+     */
+    bool try_put_if_changed(const T &v, bool *signalled = nullptr) {
+        return try_put_if_changed(v, &Base::_equal_values, signalled);
+    }
+
+    template <typename Equal>
+    bool try_put_if_changed(const T &v, Equal &&equal, bool *signalled = nullptr) {
+        if (this->_skip_unchanged(v, equal)) {
+            if (signalled) {
+                *signalled = false;
+            }
+
+            return true;
+        }
+
+        return try_put(v, signalled);
+    }
+
+    // See Disposable::warm_up, the next put signals afterwards
+    bool warm_up(const WarmUpOptions &opts = WarmUpOptions{}) {
+        const bool locked = Base::warm_up(opts);
+
+        _delivered = false;
+        _silent_puts.store(0);
+
+        return locked;
+    }
+
+    // Number of puts which updated the value without signalling
+    unsigned long long silent_puts() const {
+        return _silent_puts.load(std::memory_order_relaxed);
+    }
+
+protected:
+    Predicate _pred;
+
+    // producer side only
+    T _last_delivered{};
+    bool _delivered = false;
+    std::atomic<unsigned long long> _silent_puts{0};
+};
+
+// Predicate holding when the value moved by more than epsilon since the last delivery
+template <typename T>
+struct MovedBy {
+    T epsilon;
+
+    bool operator()(const T &last, const T &v) const {
+        return v > last ? v - last > epsilon : last - v > epsilon;
+    }
+};
+
+// Predicate holding when the value crossed the threshold since the last delivery
+template <typename T>
+struct Crossed {
+    T threshold;
+
+    bool operator()(const T &last, const T &v) const {
+        return (last < threshold) != (v < threshold);
+    }
+};
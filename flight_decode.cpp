@@ -0,0 +1,129 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+// Offline decoder of FlightRecorder dumps: prints the merged timeline of every recorded slot.
+
+struct Entry {
+  size_t recorder;
+  FlightRecord record;
+};
+
+static const char *op_name(uint8_t op) {
+  switch (static_cast<FlightOp>(op)) {
+  case FlightOp::PUT:
+    return "put";
+  case FlightOp::READ:
+    return "read";
+  }
+
+  return "?";
+}
+
+static const char *outcome_name(uint8_t outcome) {
+  switch (static_cast<FlightOutcome>(outcome)) {
+  case FlightOutcome::OK:
+    return "ok";
+  case FlightOutcome::BLOCKED:
+    return "blocked";
+  case FlightOutcome::EMPTY:
+    return "empty";
+  case FlightOutcome::SKIPPED:
+    return "skipped";
+  }
+
+  return "?";
+}
+
+static bool read_exact(FILE *f, void *data, size_t size) {
+  return fread(data, 1, size, f) == size;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <dump file>\n", argv[0]);
+    return 2;
+  }
+
+  FILE *f = fopen(argv[1], "rb");
+
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  FlightFileHeader header;
+
+  if (!read_exact(f, &header, sizeof(header)) ||
+      memcmp(header.magic, FlightFileHeader::MAGIC, sizeof(header.magic)) ||
+      header.version != FlightFileHeader::VERSION) {
+    fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<Entry> entries;
+  std::vector<FlightRecorderHeader> recorders(header.recorder_count);
+
+  for (size_t i = 0; i < recorders.size(); ++i) {
+    auto &rh = recorders[i];
+    const size_t got = fread(&rh, 1, sizeof(rh), f);
+
+    // the header counts a recorder which unregistered while a non-seekable dump was written
+    if (!got && feof(f)) {
+      fprintf(stderr, "%s: %zu of %zu recorders in the dump\n", argv[1], i, recorders.size());
+      recorders.resize(i);
+      break;
+    }
+
+    if (got != sizeof(rh)) {
+      fprintf(stderr, "%s: truncated dump\n", argv[1]);
+      return 1;
+    }
+
+    rh.name[sizeof(rh.name) - 1] = '\0';
+
+    std::vector<FlightRecord> ring(rh.capacity);
+
+    for (uint64_t next : {rh.put_next, rh.read_next}) {
+      if (!read_exact(f, ring.data(), sizeof(FlightRecord) * ring.size())) {
+        fprintf(stderr, "%s: truncated dump\n", argv[1]);
+        return 1;
+      }
+
+      for (const auto &r : ring) {
+        // skip never written records and the ones torn by a dump from another thread
+        if (r.seq && r.seq <= next && r.seq + rh.capacity > next) {
+          entries.push_back(Entry{i, r});
+        }
+      }
+    }
+
+    printf("# %s: slot %u, %llu put records, %llu read records, %u records per ring\n",
+           rh.name, rh.slot_id, (unsigned long long)rh.put_next, (unsigned long long)rh.read_next, rh.capacity);
+  }
+
+  fclose(f);
+
+  std::stable_sort(entries.begin(), entries.end(), [] (const Entry &a, const Entry &b) {
+    return a.record.timestamp_ns < b.record.timestamp_ns;
+  });
+
+  const uint64_t t0 = entries.empty() ? 0 : entries.front().record.timestamp_ns;
+
+  for (const auto &e : entries) {
+    printf("%14.3f us  %-31s %-4s #%-10llu %-7s %016llx",
+           (e.record.timestamp_ns - t0) / 1000.0, recorders[e.recorder].name, op_name(e.record.op),
+           (unsigned long long)e.record.seq, outcome_name(e.record.outcome),
+           (unsigned long long)e.record.payload_hash);
+
+    if (e.record.repeats) {
+      printf(" x%u more until %.3f us", e.record.repeats, (e.record.last_timestamp_ns - t0) / 1000.0);
+    }
+
+    printf("\n");
+  }
+
+  return 0;
+}
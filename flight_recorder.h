@@ -0,0 +1,495 @@
+#include "disposable.h"
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <initializer_list>
+#include <memory>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+
+#pragma once
+
+/**
+ * Always-on in-memory flight recorder for Disposable slots.
+ *
+ * Every recorder owns two rings, one written only by the producer and one written only by the consumer,
+ * so recording is a couple of plain stores without any shared atomics. Registered recorders are dumped
+ * to a file either on demand or from a signal handler on crash; the dump uses open/write/close only.
+ * The file is decoded offline by flight_decode.
+ */
+
+enum class FlightOp : uint8_t {
+    PUT = 1,
+    READ = 2,
+};
+
+enum class FlightOutcome : uint8_t {
+    OK = 0,
+    BLOCKED = 1,
+    EMPTY = 2,
+    // try_put_if_changed found the value unchanged
+    SKIPPED = 3,
+};
+
+struct FlightRecord {
+    // sequence number within the ring, starts at 1; 0 marks a record which was never written
+    uint64_t seq;
+    // steady clock
+    uint64_t timestamp_ns;
+    // steady clock of the last coalesced repeat, timestamp_ns if there are none
+    uint64_t last_timestamp_ns;
+    // FNV-1a of the payload, 0 if payload hashing is off
+    uint64_t payload_hash;
+    uint32_t slot_id;
+    uint8_t op;
+    uint8_t outcome;
+    // identical failed or skipped operations which followed this one, coalesced into it, saturates
+    uint16_t repeats;
+};
+
+static_assert(sizeof(FlightRecord) == 40, "FlightRecord is a part of the dump file format");
+
+struct FlightFileHeader {
+    static constexpr char MAGIC[8] = {'D', 'S', 'P', 'F', 'L', 'T', '\0', '\0'};
+    static constexpr uint32_t VERSION = 3;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t recorder_count;
+};
+
+// followed by capacity put records and capacity read records
+struct FlightRecorderHeader {
+    static constexpr size_t NAME_SIZE = 32;
+
+    char name[NAME_SIZE];
+    uint32_t slot_id;
+    uint32_t capacity;
+    uint64_t put_next;
+    uint64_t read_next;
+};
+
+class FlightRecorder {
+public:
+    static constexpr uint32_t DEFAULT_CAPACITY = 1 << 14;
+    static constexpr size_t MAX_REGISTERED = 64;
+
+    /**
+     * \param name short name to find the slot in a dump, truncated to 31 characters
+     * \param slot_id numeric id stored with every record
+     * \param capacity records per ring, should be a power of 2
+     * \param hash_payloads whether to store payload hashes, only trivially copyable payloads are hashed
+     */
+    FlightRecorder(const char *name, uint32_t slot_id, uint32_t capacity = DEFAULT_CAPACITY, bool hash_payloads = false)
+        : _slot_id{slot_id},
+          _mask{capacity - 1},
+          _hash_payloads{hash_payloads},
+          _put{new FlightRecord[capacity]()},
+          _read{new FlightRecord[capacity]()}
+    {
+        assert(capacity && !(capacity & (capacity - 1)) && "Capacity should be a power of 2");
+
+        strncpy(_name, name, sizeof(_name) - 1);
+        _name[sizeof(_name) - 1] = '\0';
+
+        _register(this);
+    }
+
+    FlightRecorder(const FlightRecorder &) = delete;
+    FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+    ~FlightRecorder() { _unregister(this); }
+
+    bool hash_payloads() const { return _hash_payloads; }
+
+    // producer side only
+    void record_put(FlightOutcome outcome, uint64_t payload_hash = 0) {
+        _record(_put.get(), _put_next, FlightOp::PUT, outcome, payload_hash);
+    }
+
+    // consumer side only
+    void record_read(FlightOutcome outcome, uint64_t payload_hash = 0) {
+        _record(_read.get(), _read_next, FlightOp::READ, outcome, payload_hash);
+    }
+
+    // Number of records written into the ring of the side, repeats don't count
+    uint64_t records(FlightOp op) const {
+        return op == FlightOp::PUT ? _put_next : _read_next;
+    }
+
+    // Most recent record of the side, \c nullptr if there's none yet; to be called from that side only
+    const FlightRecord *last(FlightOp op) const {
+        const uint64_t next = records(op);
+        const FlightRecord *ring = op == FlightOp::PUT ? _put.get() : _read.get();
+
+        return next ? &ring[(next - 1) & _mask] : nullptr;
+    }
+
+    template <typename T>
+    static uint64_t hash_payload(const T &v) {
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            const auto *p = reinterpret_cast<const unsigned char *>(&v);
+            uint64_t h = 14695981039346656037ull;
+
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                h = (h ^ p[i]) * 1099511628211ull;
+            }
+
+            return h;
+        } else {
+            return 0;
+        }
+    }
+
+    /**
+     * Dump every registered recorder into a file descriptor.
+     * Async-signal-safe.
+     *
+     * \returns \c false if any write failed
+     */
+    static bool dump_all(int fd) {
+        FlightFileHeader header{};
+        memcpy(header.magic, FlightFileHeader::MAGIC, sizeof(header.magic));
+        header.version = FlightFileHeader::VERSION;
+
+        for (auto &r : _registry()) {
+            header.recorder_count += r.load(std::memory_order_acquire) != nullptr;
+        }
+
+        // -1 if the file isn't seekable
+        const off_t start = lseek(fd, 0, SEEK_CUR);
+        bool ok = _write_all(fd, &header, sizeof(header));
+
+        // a recorder registered meanwhile is skipped so that the count stays valid
+        uint32_t left = header.recorder_count;
+
+        for (auto &r : _registry()) {
+            const FlightRecorder *rec = r.load(std::memory_order_acquire);
+
+            if (!rec || !left) {
+                continue;
+            }
+
+            ok = rec->_dump(fd) && ok;
+            --left;
+        }
+
+        // a recorder unregistered meanwhile is missing, correct the count if possible,
+        // flight_decode accepts a dump which ends early otherwise
+        if (left) {
+            header.recorder_count -= left;
+            ok = start >= 0 && pwrite(fd, &header, sizeof(header), start) == sizeof(header) && ok;
+        }
+
+        return ok;
+    }
+
+    /**
+     * Dump every registered recorder into a file, overwriting it.
+     * Async-signal-safe.
+     */
+    static bool dump_all(const char *path) {
+        const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        const bool ok = dump_all(fd);
+
+        return close(fd) == 0 && ok;
+    }
+
+    /**
+     * Dump the recorders into path on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT,
+     * then re-raise the signal with the default disposition.
+     *
+     * \param dump_signal additional signal which dumps on demand without terminating, 0 for none
+     * \returns \c false if path is too long or a handler couldn't be installed
+     */
+    static bool install_crash_handler(const char *path, int dump_signal = 0) {
+        char *dump_path = _dump_path();
+
+        if (strlen(path) >= PATH_SIZE) {
+            return false;
+        }
+
+        strcpy(dump_path, path);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = &_on_crash;
+        sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+
+        bool ok = true;
+
+        for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+            ok = sigaction(sig, &sa, nullptr) == 0 && ok;
+        }
+
+        if (dump_signal) {
+            sa.sa_handler = &_on_demand;
+            sa.sa_flags = SA_RESTART;
+            ok = sigaction(dump_signal, &sa, nullptr) == 0 && ok;
+        }
+
+        return ok;
+    }
+
+protected:
+    static constexpr size_t PATH_SIZE = 256;
+
+    char _name[FlightRecorderHeader::NAME_SIZE];
+    uint32_t _slot_id;
+    uint32_t _mask;
+    bool _hash_payloads;
+
+    std::unique_ptr<FlightRecord[]> _put;
+    std::unique_ptr<FlightRecord[]> _read;
+
+    alignas(64) uint64_t _put_next = 0;
+    alignas(64) uint64_t _read_next = 0;
+
+    using Registry = std::atomic<const FlightRecorder *>[MAX_REGISTERED];
+
+    static Registry &_registry() {
+        static Registry registry{};
+        return registry;
+    }
+
+    static char *_dump_path() {
+        static char path[PATH_SIZE];
+        return path;
+    }
+
+    static void _register(const FlightRecorder *rec) {
+        for (auto &r : _registry()) {
+            const FlightRecorder *expected = nullptr;
+
+            if (r.compare_exchange_strong(expected, rec)) {
+                return;
+            }
+        }
+
+        // too many recorders, this one works but is never dumped
+    }
+
+    static void _unregister(const FlightRecorder *rec) {
+        for (auto &r : _registry()) {
+            const FlightRecorder *expected = rec;
+
+            if (r.compare_exchange_strong(expected, nullptr)) {
+                return;
+            }
+        }
+    }
+
+    static uint64_t _now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void _record(FlightRecord *ring, uint64_t &next, FlightOp op, FlightOutcome outcome, uint64_t payload_hash) {
+        // a consumer polling an empty slot would flush the ring with identical records otherwise
+        if (outcome != FlightOutcome::OK && next) {
+            FlightRecord &prev = ring[(next - 1) & _mask];
+
+            if (prev.op == static_cast<uint8_t>(op) && prev.outcome == static_cast<uint8_t>(outcome) &&
+                prev.payload_hash == payload_hash && prev.repeats != UINT16_MAX) {
+                prev.last_timestamp_ns = _now_ns();
+                ++prev.repeats;
+                return;
+            }
+        }
+
+        FlightRecord &r = ring[next & _mask];
+
+        r.timestamp_ns = _now_ns();
+        r.last_timestamp_ns = r.timestamp_ns;
+        r.payload_hash = payload_hash;
+        r.slot_id = _slot_id;
+        r.op = static_cast<uint8_t>(op);
+        r.outcome = static_cast<uint8_t>(outcome);
+        r.repeats = 0;
+
+        // a dump from a signal handler on this thread sees either the old or the complete record
+        std::atomic_signal_fence(std::memory_order_release);
+        r.seq = ++next;
+    }
+
+    bool _dump(int fd) const {
+        FlightRecorderHeader header{};
+        memcpy(header.name, _name, sizeof(header.name));
+        header.slot_id = _slot_id;
+        header.capacity = _mask + 1;
+        header.put_next = _put_next;
+        header.read_next = _read_next;
+
+        bool ok = _write_all(fd, &header, sizeof(header));
+        ok = _write_all(fd, _put.get(), sizeof(FlightRecord) * header.capacity) && ok;
+        ok = _write_all(fd, _read.get(), sizeof(FlightRecord) * header.capacity) && ok;
+
+        return ok;
+    }
+
+    static bool _write_all(int fd, const void *data, size_t size) {
+        const char *p = static_cast<const char *>(data);
+
+        while (size) {
+            const ssize_t rc = write(fd, p, size);
+
+            if (rc < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            p += rc;
+            size -= rc;
+        }
+
+        return true;
+    }
+
+    static void _on_crash(int sig) {
+        const int saved_errno = errno;
+        dump_all(_dump_path());
+        errno = saved_errno;
+
+        // SA_RESETHAND restored the default disposition
+        raise(sig);
+    }
+
+    static void _on_demand(int) {
+        const int saved_errno = errno;
+        dump_all(_dump_path());
+        errno = saved_errno;
+    }
+};
+
+/**
+ * Disposable which records the outcome of every put and read into a flight recorder.
+ * Consecutive failed reads, e.g. polls of an empty slot, are coalesced into a single record.
+ */
+template <typename T, typename YieldF = void (*)(), unsigned int block_retries = 2>
+class RecordedDisposable : public Disposable<T, YieldF, block_retries> {
+public:
+    using Base = Disposable<T, YieldF, block_retries>;
+    using Self = RecordedDisposable<T, YieldF, block_retries>;
+    using Yielder = typename Base::Yielder;
+
+    /**
+     * Read lock which records every lock attempt, see Disposable::ReadLock.
+     */
+    class ReadLock {
+    private:
+        friend Self;
+
+        using PtrT = const T *;
+        using RefT = const T &;
+
+        Self &_host;
+        typename Base::ReadLock _lock;
+
+        ReadLock(Self &h, bool try_lock = false) : _host{h}, _lock{h.Base::get_lock()}
+        {
+            if (try_lock) {
+                this->try_lock();
+            }
+        }
+
+    public:
+        bool try_lock() {
+            if (_lock.try_lock()) {
+                _host._recorder.record_read(FlightOutcome::OK, _host._hash(*_lock.read()));
+                return true;
+            }
+
+            _host._recorder.record_read(_host._failure_outcome());
+            return false;
+        }
+
+        void unlock() { _lock.unlock(); }
+        bool writer_waiting() const { return _lock.writer_waiting(); }
+        bool is_locked() const { return _lock.is_locked(); }
+        PtrT read() const { return _lock.read(); }
+        operator PtrT () const { return read(); }
+        operator RefT () const { return *read(); }
+        operator bool() const { return is_locked(); }
+    };
+
+    RecordedDisposable(Yielder &&yield, const char *name, uint32_t slot_id,
+                       uint32_t capacity = FlightRecorder::DEFAULT_CAPACITY, bool hash_payloads = false)
+        : Base{std::move(yield)}, _recorder{name, slot_id, capacity, hash_payloads}
+    {}
+
+    ReadLock get_lock() {
+        return ReadLock{*this};
+    }
+
+    ReadLock try_lock() {
+        return ReadLock{*this, true};
+    }
+
+    bool try_read_into(T &ret) {
+        if (Base::try_read_into(ret)) {
+            _recorder.record_read(FlightOutcome::OK, _hash(ret));
+            return true;
+        }
+
+        _recorder.record_read(_failure_outcome());
+        return false;
+    }
+
+    bool try_put(const T &v) {
+        const bool rc = Base::try_put(v);
+        _recorder.record_put(rc ? FlightOutcome::OK : FlightOutcome::BLOCKED, _hash(v));
+
+        return rc;
+    }
+
+    bool try_put_if_changed(const T &v) {
+        const unsigned long long suppressed = this->suppressed_puts();
+        return _record_put_if_changed(Base::try_put_if_changed(v), suppressed, v);
+    }
+
+    template <typename Equal>
+    bool try_put_if_changed(const T &v, Equal &&equal) {
+        const unsigned long long suppressed = this->suppressed_puts();
+        return _record_put_if_changed(Base::try_put_if_changed(v, std::forward<Equal>(equal)), suppressed, v);
+    }
+
+    FlightRecorder &recorder() { return _recorder; }
+
+protected:
+    FlightRecorder _recorder;
+
+    uint64_t _hash(const T &v) const {
+        return _recorder.hash_payloads() ? FlightRecorder::hash_payload(v) : 0;
+    }
+
+    // best effort: the state may have changed since the failed attempt
+    FlightOutcome _failure_outcome() const {
+        return (this->_state.load(std::memory_order_relaxed) & Base::STATE_STORAGE_EMPTY_MASK)
+            ? FlightOutcome::EMPTY : FlightOutcome::BLOCKED;
+    }
+
+    // only the producer counts suppressed puts, so a changed counter means this put was skipped
+    bool _record_put_if_changed(bool rc, unsigned long long suppressed_before, const T &v) {
+        const FlightOutcome outcome = !rc ? FlightOutcome::BLOCKED
+            : this->suppressed_puts() != suppressed_before ? FlightOutcome::SKIPPED : FlightOutcome::OK;
+        _recorder.record_put(outcome, _hash(v));
+
+        return rc;
+    }
+};
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#pragma once
+
+/**
+ * Thread pool running consumer tasks of latest-value slots in order of freshness deadlines.
+ *
+ * Every task has a staleness budget. The producer calls notify() after a put; the task becomes
+ * runnable with the deadline of the oldest update it hasn't seen plus its budget, and the workers
+ * always run the task with the earliest deadline (EDF). Updates arriving while the task is queued
+ * are conflated by the slot, so a task is queued at most once and never runs on two workers at a time,
+ * which keeps the single Consumer assumption of the slots.
+ *
+ * A task which starts later than its budget allows is reported as a violation.
+ */
+class FreshnessExecutor {
+public:
+    using TaskId = size_t;
+
+    struct Violation {
+        TaskId task;
+        uint64_t staleness_ns;
+        uint64_t budget_ns;
+    };
+
+    using ViolationLog = void (*)(const Violation &);
+
+    struct TaskStats {
+        // runs which read a value
+        unsigned long long runs;
+        unsigned long long violations;
+        uint64_t worst_staleness_ns;
+    };
+
+    static void log_violation(const Violation &v) {
+        fprintf(stderr, "[freshness] task %zu started %llu ns after the update, budget %llu ns\n",
+                v.task, (unsigned long long)v.staleness_ns, (unsigned long long)v.budget_ns);
+    }
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    explicit FreshnessExecutor(unsigned threads, ViolationLog log = &log_violation) : _log{log} {
+        for (unsigned i = 0; i < threads; ++i) {
+            _workers.emplace_back([this] () { _work(); });
+        }
+    }
+
+    FreshnessExecutor(const FreshnessExecutor &) = delete;
+    FreshnessExecutor &operator=(const FreshnessExecutor &) = delete;
+
+    ~FreshnessExecutor() {
+        {
+            std::lock_guard<std::mutex> lock{_lock};
+            _stop = true;
+        }
+
+        _cv.notify_all();
+
+        for (auto &t : _workers) {
+            t.join();
+        }
+    }
+
+    /**
+     * Register a consumer task of a slot.
+     * The slot has to outlive the executor.
+     *
+     * \param budget_ns how long an update may wait for the task
+     * \param fn called with the value read from the slot
+     */
+    template <typename Slot, typename Fn>
+    TaskId add_consumer(Slot &slot, uint64_t budget_ns, Fn fn) {
+        std::unique_ptr<Task> task{new Task};
+        task->budget_ns = budget_ns;
+        task->run = [&slot, fn] () mutable {
+            typename Slot::Type v;
+
+            if (!slot.try_read_into(v)) {
+                return false;
+            }
+
+            fn(static_cast<const typename Slot::Type &>(v));
+            return true;
+        };
+
+        std::lock_guard<std::mutex> lock{_lock};
+        _tasks.push_back(std::move(task));
+
+        return _tasks.size() - 1;
+    }
+
+    // Tell the executor the slot of the task has been updated, called by the producer after a put
+    void notify(TaskId id) {
+        const uint64_t now = now_ns();
+        bool wake = false;
+
+        {
+            std::lock_guard<std::mutex> lock{_lock};
+            Task &t = *_tasks[id];
+
+            if (!t.pending_since_ns) {
+                t.pending_since_ns = now;
+            }
+
+            switch (t.state) {
+            case TaskState::IDLE:
+                t.state = TaskState::QUEUED;
+                _ready.push(Ready{t.pending_since_ns + t.budget_ns, id});
+                wake = true;
+                break;
+
+            case TaskState::RUNNING:
+                t.state = TaskState::RUNNING_DIRTY;
+                break;
+
+            case TaskState::QUEUED:
+            case TaskState::RUNNING_DIRTY:
+                break;
+            }
+        }
+
+        if (wake) {
+            _cv.notify_one();
+        }
+    }
+
+    /**
+     * Put into the slot of the task and notify on success.
+     *
+     * \returns result of slot.try_put
+     */
+    template <typename Slot>
+    bool publish(TaskId id, Slot &slot, const typename Slot::Type &v) {
+        if (!slot.try_put(v)) {
+            return false;
+        }
+
+        notify(id);
+
+        return true;
+    }
+
+    TaskStats stats(TaskId id) const {
+        std::lock_guard<std::mutex> lock{_lock};
+        return _tasks[id]->stats;
+    }
+
+    void report(FILE *f) const {
+        std::lock_guard<std::mutex> lock{_lock};
+
+        fprintf(f, "%-6s %12s %12s %14s %14s\n", "task", "runs", "violations", "budget ns", "worst ns");
+
+        for (size_t i = 0; i < _tasks.size(); ++i) {
+            const Task &t = *_tasks[i];
+
+            fprintf(f, "%-6zu %12llu %12llu %14llu %14llu\n", i, t.stats.runs, t.stats.violations,
+                    (unsigned long long)t.budget_ns, (unsigned long long)t.stats.worst_staleness_ns);
+        }
+    }
+
+protected:
+    enum class TaskState : uint8_t {
+        IDLE,
+        QUEUED,
+        RUNNING,
+        // updated while running, queued again once it's done
+        RUNNING_DIRTY,
+    };
+
+    struct Task {
+        // returns whether a value was read
+        std::function<bool()> run;
+        uint64_t budget_ns = 0;
+        // the oldest update the task hasn't seen yet, 0 if none
+        uint64_t pending_since_ns = 0;
+        TaskState state = TaskState::IDLE;
+        TaskStats stats{};
+    };
+
+    struct Ready {
+        uint64_t deadline_ns;
+        TaskId task;
+
+        // std::priority_queue is a max heap
+        bool operator<(const Ready &other) const { return deadline_ns > other.deadline_ns; }
+    };
+
+    ViolationLog _log;
+
+    mutable std::mutex _lock;
+    std::condition_variable _cv;
+    std::vector<std::unique_ptr<Task>> _tasks;
+    std::priority_queue<Ready> _ready;
+    bool _stop = false;
+
+    std::vector<std::thread> _workers;
+
+    void _work() {
+        std::unique_lock<std::mutex> lock{_lock};
+
+        for (;;) {
+            _cv.wait(lock, [this] () { return _stop || !_ready.empty(); });
+
+            if (_stop) {
+                return;
+            }
+
+            const TaskId id = _ready.top().task;
+            _ready.pop();
+
+            Task &t = *_tasks[id];
+            const uint64_t staleness = now_ns() - t.pending_since_ns;
+
+            t.state = TaskState::RUNNING;
+            t.pending_since_ns = 0;
+
+            lock.unlock();
+
+            // an update notified while the previous run hadn't read the slot yet was consumed by that run,
+            // the requeued run finds the slot empty then and neither counts nor can be late
+            const bool consumed = t.run();
+            const bool violated = consumed && staleness > t.budget_ns;
+
+            if (violated && _log) {
+                _log(Violation{id, staleness, t.budget_ns});
+            }
+
+            lock.lock();
+
+            if (consumed) {
+                ++t.stats.runs;
+                t.stats.violations += violated;
+                t.stats.worst_staleness_ns = std::max(t.stats.worst_staleness_ns, staleness);
+            }
+
+            if (t.state == TaskState::RUNNING_DIRTY) {
+                t.state = TaskState::QUEUED;
+                _ready.push(Ready{t.pending_since_ns + t.budget_ns, id});
+                _cv.notify_one();
+            } else {
+                t.state = TaskState::IDLE;
+            }
+        }
+    }
+};
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma once
+
+/**
+ * Thin wrappers of the futex syscalls used to park consumers on slot state words.
+ * All of them operate on process private 32-bit words.
+ */
+
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "State words have to be plain 32-bit words");
+
+// Most words futex_waitv accepts at once
+static constexpr size_t FUTEX_WAITV_MAX_WORDS = 128;
+
+// Wake every thread waiting on the word
+inline void futex_wake_all(std::atomic<uint32_t> &word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+/**
+ * Sleep while the word holds the expected value.
+ *
+ * \param timeout relative timeout, \c nullptr to wait forever
+ * \returns 0 when woken, errno otherwise: EAGAIN if the word didn't hold the value, ETIMEDOUT, EINTR
+ */
+inline int futex_wait(std::atomic<uint32_t> &word, uint32_t expected, const timespec *timeout) {
+    const long rc = syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected,
+                            timeout, nullptr, 0);
+
+    return rc < 0 ? errno : 0;
+}
+
+/**
+ * Sleep while every word holds its expected value, futex_waitv(2), Linux 5.16+.
+ *
+ * \param count number of words, up to FUTEX_WAITV_MAX_WORDS
+ * \param deadline absolute CLOCK_MONOTONIC deadline, \c nullptr to wait forever
+ * \returns 0 when woken, errno otherwise: ENOSYS if unsupported, EAGAIN if a word didn't hold its value,
+ * ETIMEDOUT, EINTR
+ */
+inline int futex_waitv(std::atomic<uint32_t> *const *words, const uint32_t *expected, size_t count,
+                       const timespec *deadline) {
+    // struct futex_waitv, spelled out for older kernel headers
+    struct Waiter {
+        uint64_t val;
+        uint64_t uaddr;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    static constexpr uint32_t SIZE_U32 = 2;
+
+    Waiter waiters[FUTEX_WAITV_MAX_WORDS];
+
+    for (size_t i = 0; i < count; ++i) {
+        waiters[i] = Waiter{expected[i], reinterpret_cast<uintptr_t>(words[i]), SIZE_U32 | FUTEX_PRIVATE_FLAG, 0};
+    }
+
+    const long rc = syscall(SYS_futex_waitv, waiters, static_cast<unsigned>(count), 0, deadline, CLOCK_MONOTONIC);
+
+    return rc < 0 ? errno : 0;
+}
@@ -0,0 +1,85 @@
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+#pragma once
+
+/**
+ * Placements of a slot relative to a hot word written by another thread,
+ * e.g. by the false sharing antagonists of the benchmarks.
+ */
+
+// Word sharing the slot's last line with the last members of the slot
+template <typename Slot>
+struct PackedLayout {
+private:
+    // an over-aligned slot ends on a line boundary, so a word placed after it would never share a line;
+    // a derived class may reuse its tail padding though
+    struct Packed : Slot {
+        template <typename... Args>
+        Packed(Args &&... args) : Slot{std::forward<Args>(args)...} {}
+
+        std::atomic<uint64_t> neighbor{0};
+    };
+
+    // Packed isn't standard layout, GCC and Clang support offsetof on it nonetheless
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+    static constexpr size_t WORD = offsetof(Packed, neighbor);
+#pragma GCC diagnostic pop
+
+    static constexpr bool _shares_line(size_t lead) {
+        return (lead + WORD) % 64 && (lead + WORD) / 64 == (lead + sizeof(Slot) - 1) / 64;
+    }
+
+    // other slots are shifted within the line, so that the word right behind them isn't at the start of a line
+    static constexpr size_t _lead() {
+        for (size_t lead = 0; lead < 64; lead += alignof(Packed)) {
+            if (_shares_line(lead)) {
+                return lead;
+            }
+        }
+
+        return 0;
+    }
+
+    static constexpr size_t LEAD = _lead();
+
+    static_assert(_shares_line(LEAD), "The word doesn't share the last line of the slot");
+
+    alignas(64) unsigned char _buffer[LEAD + sizeof(Packed)];
+    // constructed before the references below bind to it
+    Packed &_packed;
+
+public:
+    static constexpr const char *NAME = "packed";
+    using SlotType = Slot;
+
+    template <typename... Args>
+    PackedLayout(Args &&... args)
+        : _packed{*new (_buffer + LEAD) Packed{std::forward<Args>(args)...}}, slot{_packed}, neighbor{_packed.neighbor}
+    {}
+
+    PackedLayout(const PackedLayout &) = delete;
+    PackedLayout &operator=(const PackedLayout &) = delete;
+
+    ~PackedLayout() { _packed.~Packed(); }
+
+    Slot &slot;
+    std::atomic<uint64_t> &neighbor;
+};
+
+// Slot and the word on separate pairs of lines, out of reach of the adjacent line prefetcher
+template <typename Slot>
+struct PaddedLayout {
+    static constexpr const char *NAME = "padded";
+    using SlotType = Slot;
+
+    template <typename... Args>
+    PaddedLayout(Args &&... args) : slot{std::forward<Args>(args)...} {}
+
+    alignas(128) Slot slot;
+    alignas(128) std::atomic<uint64_t> neighbor{0};
+};
@@ -1,8 +1,22 @@
 #include "disposable.h"
+#include "arena.h"
+#include "adaptive_disposable.h"
+#include "arbitrated_disposable.h"
+#include "competing_disposable.h"
+#include "disposable_table.h"
+#include "filtered_disposable.h"
+#include "flight_recorder.h"
+#include "freshness_executor.h"
+#include "persistent_map.h"
+#include "tiered_map.h"
+#include "topology.h"
+#include "wait_any.h"
 
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <stdio.h>
+#include <vector>
 
 static constexpr size_t SIZE = 100;
 struct Data {
@@ -11,6 +25,21 @@ struct Data {
 
 Disposable<Data> disposable{&std::this_thread::yield};
 
+// every key collides, so the map has to fall back to its collision lists
+struct CollidingHash {
+  size_t operator()(int) const { return 42; }
+};
+
+// lets the test hold the consumers back as a bulk load in progress does
+struct HeldTable : DisposableTable<int> {
+  using DisposableTable<int>::DisposableTable;
+
+  void hold(bool on) { _ready.store(!on); }
+
+  // a consumer which got past the gate before the load started
+  bool read_past_gate(size_t id, int &v) { return _slots[id].try_read_into_if_ready(_ready, v); }
+};
+
 void prepare_data(Data &d, unsigned long long idx) {
    for (size_t i = 0; i < SIZE; ++i) {
       d.v[i] = idx;
@@ -122,9 +151,697 @@ int main(int argc, char **argv) {
     assert(11 == v2);
   }
 
+  {
+    using Adaptive = AdaptiveDisposable<int>;
+    Adaptive::Policy policy;
+    policy.window = 4;
+    policy.contention_enter_per_mille = 0;
+    Adaptive d{&std::this_thread::yield, policy, nullptr};
+    int v;
+    bool success;
+
+    for (v = 1; v <= 5; ++v) {
+      success = d.try_put(v);
+      assert(success);
+    }
+
+    // the migration waits for the consumer to take the pending value
+    assert(Adaptive::Engine::LOCK_COPY == d.engine());
+    success = d.try_read_into(v);
+    assert(success);
+    assert(5 == v);
+
+    v = 6;
+    success = d.try_put(v);
+    assert(success);
+    assert(Adaptive::Engine::TRIPLE_BUFFER == d.engine());
+
+    success = d.try_read_into(v);
+    assert(success);
+    assert(6 == v);
+
+    success = d.try_read_into(v);
+    assert(!success);
+  }
+
+  {
+    // a polling consumer on a quiet slot isn't contention
+    using Adaptive = AdaptiveDisposable<int>;
+    Adaptive::Policy policy;
+    policy.window = 4;
+    Adaptive d{&std::this_thread::yield, policy, nullptr};
+    int r;
+    bool success;
+
+    for (int v = 1; v <= 64; ++v) {
+      success = d.try_put(v);
+      assert(success);
+
+      for (int i = 0; i < 8; ++i) {
+        d.try_read_into(r);
+      }
+
+      assert(Adaptive::Engine::LOCK_COPY == d.engine());
+    }
+  }
+
+  {
+    CompetingDisposable<int> d{&std::this_thread::yield};
+    int v = 0;
+    bool success;
+
+    success = d.try_claim_into(v, 0);
+    assert(!success);
+
+    v = 12;
+    success = d.try_put(v);
+    assert(success);
+
+    // worker 0 has been waiting longer
+    success = d.try_claim_into(v, 1);
+    assert(!success);
+    success = d.try_claim_into(v, 0);
+    assert(success);
+    assert(12 == v);
+
+    v = 13;
+    d.try_put(v);
+    v = 14;
+    d.try_put(v);
+    assert(1 == d.overwritten());
+
+    // worker 0 has just been served and yields to worker 1
+    success = d.try_claim_into(v, 0);
+    assert(!success);
+    success = d.try_claim_into(v, 1);
+    assert(success);
+    assert(14 == v);
+
+    success = d.try_claim_into(v, 1);
+    assert(!success);
+  }
+
+  {
+    CompetingDisposable<Data> d{&std::this_thread::yield};
+    std::atomic<bool> done{false};
+    std::vector<unsigned long long> claimed[2];
+
+    auto worker = [&d, &done, &claimed] (unsigned id) {
+      Data v;
+      bool last = false;
+
+      prepare_data(v, 0);
+
+      // one more attempt after the producer is done picks up the last value
+      while (!last) {
+        last = done.load();
+
+        while (d.try_claim_into(v, id)) {
+          for (size_t i = 0; i < SIZE; ++i) {
+            assert(v.v[i] == v.v[0]);
+          }
+
+          claimed[id].push_back(v.v[0]);
+        }
+
+        // a lost claim leaves the previous value untouched
+        for (size_t i = 0; i < SIZE; ++i) {
+          assert(v.v[i] == (claimed[id].empty() ? 0 : claimed[id].back()));
+        }
+
+        std::this_thread::yield();
+      }
+    };
+
+    std::thread w0{worker, 0}, w1{worker, 1};
+    Data v;
+
+    for (unsigned long long i = 1; i <= 20000; ++i) {
+      prepare_data(v, i);
+      d.try_put(v);
+    }
+
+    done.store(true);
+    w0.join();
+    w1.join();
+
+    std::vector<unsigned long long> all{claimed[0]};
+    all.insert(all.end(), claimed[1].begin(), claimed[1].end());
+    std::sort(all.begin(), all.end());
+
+    assert(!all.empty() && 20000 == all.back());
+    assert(std::adjacent_find(all.begin(), all.end()) == all.end());
+    assert(all.size() + d.overwritten() == 20000);
+  }
+
+  {
+    Disposable<int> d{&std::this_thread::yield};
+    int v = 15;
+    int v2;
+    bool success;
+
+    success = d.try_put_if_changed(v);
+    assert(success);
+    success = d.try_read_into(v2);
+    assert(success);
+
+    success = d.try_put_if_changed(v);
+    assert(success);
+    assert(1 == d.suppressed_puts());
+
+    // nothing new for the consumer
+    success = d.try_read_into(v2);
+    assert(!success);
+
+    v = 16;
+    success = d.try_put_if_changed(v);
+    assert(success);
+    success = d.try_read_into(v2);
+    assert(success);
+    assert(16 == v2);
+  }
+
+  {
+    using Arbitrated = ArbitratedDisposable<int>;
+    Arbitrated d{&std::this_thread::yield};
+    int v;
+    uint64_t seq;
+    Arbitrated::PutResult put;
+    bool success;
+
+    put = d.try_put(0, 1, 17);
+    assert(Arbitrated::PutResult::ACCEPTED == put);
+    put = d.try_put(1, 1, 17);
+    assert(Arbitrated::PutResult::STALE == put);
+    // line 0 lost sequence 2
+    put = d.try_put(1, 2, 18);
+    assert(Arbitrated::PutResult::ACCEPTED == put);
+    put = d.try_put(0, 3, 19);
+    assert(Arbitrated::PutResult::ACCEPTED == put);
+    put = d.try_put(1, 3, 19);
+    assert(Arbitrated::PutResult::STALE == put);
+
+    success = d.try_read_into(v, &seq);
+    assert(success);
+    assert(19 == v);
+    assert(3 == seq);
+
+    assert(2 == d.line_stats(0).wins);
+    assert(1 == d.line_stats(0).gaps);
+    assert(1 == d.line_stats(1).wins);
+    assert(2 == d.line_stats(1).losses);
+    assert(0 == d.missed());
+  }
+
+  {
+    Disposable<int> d{&std::this_thread::yield};
+    int v = 20;
+    bool success;
+
+    success = d.try_put(v);
+    assert(success);
+
+    {
+      auto lock = d.try_lock();
+      assert(lock);
+      assert(!lock.writer_waiting());
+
+      success = d.try_put(v);
+      assert(!success);
+      assert(lock.writer_waiting());
+    }
+
+    success = d.try_put(v);
+    assert(success);
+    assert(1 == d.writer_wait_stats().waits);
+
+    auto lock = d.try_lock();
+    assert(lock);
+    assert(!lock.writer_waiting());
+  }
+
+  {
+    Disposable<int> d{&std::this_thread::yield};
+    WarmUpOptions opts;
+    opts.handoffs = 16;
+    int v;
+    bool success;
+
+    d.warm_up(opts);
+
+    success = d.try_read_into(v);
+    assert(!success);
+
+    // locking is opt-in and the caller releases what it locked, RLIMIT_MEMLOCK permitting
+    opts.lock_memory = true;
+
+    if (d.warm_up(opts)) {
+      success = release_memory(&d, sizeof(d));
+      assert(success);
+    }
+  }
+
+  {
+    FilteredDisposable<int, MovedBy<int>> d{&std::this_thread::yield, MovedBy<int>{5}};
+    int v;
+    bool success, signalled;
+
+    success = d.try_put(100, &signalled);
+    assert(success);
+    assert(signalled);
+
+    // unread value is replaced silently and is what the consumer gets
+    success = d.try_put(103, &signalled);
+    assert(success);
+    assert(signalled);
+
+    success = d.try_read_into(v);
+    assert(success);
+    assert(103 == v);
+
+    success = d.try_put(106, &signalled);
+    assert(success);
+    assert(!signalled);
+
+    success = d.try_read_into(v);
+    assert(!success);
+
+    success = d.try_put(109, &signalled);
+    assert(success);
+    assert(signalled);
+
+    success = d.try_read_into(v);
+    assert(success);
+    assert(109 == v);
+    assert(2 == d.silent_puts());
+
+    // changed values go through the predicate as well
+    success = d.try_put_if_changed(112, &signalled);
+    assert(success);
+    assert(!signalled);
+
+    success = d.try_read_into(v);
+    assert(!success);
+    assert(3 == d.silent_puts());
+
+    success = d.try_put_if_changed(112, &signalled);
+    assert(success);
+    assert(!signalled);
+    assert(1 == d.suppressed_puts());
+  }
+
+  {
+    ArenaDisposable<std::pmr::vector<int>> d{&std::this_thread::yield};
+    bool success;
+
+    for (int i = 0; i < 2; ++i) {
+      ArenaEpoch epoch;
+      std::pmr::vector<int> v(64, i, &epoch.arena());
+
+      success = d.try_put(v);
+      assert(success);
+    }
+
+    {
+      ArenaEpoch epoch;
+      std::pmr::vector<int> v{&epoch.arena()};
+
+      success = d.try_read_into(v);
+      assert(success);
+      assert(64 == v.size() && 1 == v[0]);
+      assert(v.get_allocator().resource() == &epoch.arena());
+    }
+
+    assert(1 == thread_arena().upstream_allocations());
+  }
+
+  {
+    Disposable<Data> d{&std::this_thread::yield};
+    Data v{};
+    bool success;
+
+    success = d.set_demote_on_publish(true);
+    assert(success == CpuFeatures::get().cldemote());
+
+    v.v[0] = 21;
+    success = d.try_put(v);
+    assert(success);
+
+    v.v[0] = 0;
+    success = d.try_read_into(v);
+    assert(success);
+    assert(21 == v.v[0]);
+  }
+
+  {
+    Disposable<int> d{&std::this_thread::yield};
+    int v = 22;
+    bool success;
+
+    success = d.try_put(v);
+    assert(success);
+
+    success = d.try_read_into(v);
+    assert(success);
+    assert(!d.newer_available());
+
+    auto token = d.token();
+    assert(!token.stale());
+
+    success = d.try_put(v);
+    assert(success);
+    assert(d.newer_available());
+    assert(token.stale());
+
+    success = d.try_read_into(v);
+    assert(success);
+    assert(!d.token().stale());
+  }
+
+  {
+    Disposable<int> a{&std::this_thread::yield};
+    Disposable<long> b{&std::this_thread::yield};
+    int idx;
+    bool success;
+
+    idx = wait_any_for(1000, a, b);
+    assert(-1 == idx);
+
+    success = b.try_put(23);
+    assert(success);
+
+    idx = wait_any(a, b);
+    assert(1 == idx);
+  }
+
+  {
+    RecordedDisposable<int> d{&std::this_thread::yield, "main", 1, 16, true};
+    FlightRecorder &rec = d.recorder();
+    int v;
+    bool success;
+
+    // polls of an empty slot share a record
+    for (int i = 0; i < 8; ++i) {
+      success = d.try_read_into(v);
+      assert(!success);
+    }
+
+    assert(1 == rec.records(FlightOp::READ));
+    assert(7 == rec.last(FlightOp::READ)->repeats);
+    assert(rec.last(FlightOp::READ)->last_timestamp_ns >= rec.last(FlightOp::READ)->timestamp_ns);
+
+    success = d.try_put_if_changed(24);
+    assert(success);
+
+    success = d.try_put_if_changed(24);
+    assert(success);
+    assert(2 == rec.records(FlightOp::PUT));
+    assert(static_cast<uint8_t>(FlightOutcome::SKIPPED) == rec.last(FlightOp::PUT)->outcome);
+
+    {
+      auto lock = d.try_lock();
+      assert(lock.is_locked() && 24 == *lock.read());
+    }
+
+    assert(2 == rec.records(FlightOp::READ));
+    assert(static_cast<uint8_t>(FlightOutcome::OK) == rec.last(FlightOp::READ)->outcome);
+    assert(FlightRecorder::hash_payload(24) == rec.last(FlightOp::READ)->payload_hash);
+
+    char path[] = "/tmp/disposable_flight_XXXXXX";
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+
+    success = FlightRecorder::dump_all(fd);
+    assert(success);
+
+    FlightFileHeader header;
+    success = pread(fd, &header, sizeof(header), 0) == sizeof(header);
+    assert(success);
+    assert(1 == header.recorder_count);
+
+    const off_t size = lseek(fd, 0, SEEK_END);
+    assert(size == sizeof(header) + sizeof(FlightRecorderHeader) + 2 * 16 * sizeof(FlightRecord));
+    close(fd);
+  }
+
+  {
+    TieredDisposableMap<int, int> m{&std::this_thread::yield, 2};
+    char path[] = "/tmp/disposable_cold_XXXXXX";
+    int v;
+    bool success;
+
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    success = m.open(path, 16);
+    assert(success);
+    unlink(path);
+
+    for (int k = 1; k <= 3; ++k) {
+      success = m.try_put(k, k * 10);
+      assert(success);
+    }
+
+    assert(1 == m.evictions());
+
+    // hot slots keep their unread values across warm up
+    WarmUpOptions opts;
+    opts.lock_memory = false;
+    opts.handoffs = 16;
+    m.warm_up(opts);
+
+    // every key still holds its unread value, cold ones are faulted in
+    for (int k = 1; k <= 3; ++k) {
+      success = m.try_read_into(k, v);
+      assert(success);
+      assert(k * 10 == v);
+
+      success = m.try_read_into(k, v);
+      assert(!success);
+    }
+
+    assert(1 <= m.faults());
+
+    // read keys stay read across eviction and aren't faulted in by reads
+    const unsigned long long faults = m.faults();
+
+    for (int k = 1; k <= 3; ++k) {
+      success = m.try_read_into(k, v);
+      assert(!success);
+    }
+
+    assert(faults == m.faults());
+
+    success = m.try_read_into(4, v);
+    assert(!success);
+
+    success = m.try_put(1, 11);
+    assert(success);
+
+    success = m.try_read_into(1, v);
+    assert(success);
+    assert(11 == v);
+  }
+
+  {
+    Disposable<int> d{&std::this_thread::yield};
+    FreshnessExecutor executor{1, nullptr};
+    std::atomic<int> runs{0}, last{0};
+    std::atomic<bool> release{false};
+
+    const auto id = executor.add_consumer(d, 1000000000, [&runs, &last, &release] (int v) {
+      last.store(v);
+
+      // the first run holds the worker until the updates below arrive
+      if (1 == ++runs) {
+        while (!release.load()) {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    bool success = executor.publish(id, d, 1);
+    assert(success);
+
+    while (!runs.load()) {
+      std::this_thread::yield();
+    }
+
+    // updates while running are conflated into a single requeued run
+    success = executor.publish(id, d, 2);
+    assert(success);
+    success = executor.publish(id, d, 3);
+    assert(success);
+    release.store(true);
+
+    // runs are accounted once the callback returns
+    while (executor.stats(id).runs < 2) {
+      std::this_thread::yield();
+    }
+
+    assert(3 == last.load());
+    assert(2 == runs.load());
+    assert(0 == executor.stats(id).violations);
+
+    // a run finding the slot empty isn't counted
+    executor.notify(id);
+    success = executor.publish(id, d, 4);
+    assert(success);
+
+    while (executor.stats(id).runs < 3) {
+      std::this_thread::yield();
+    }
+
+    assert(4 == last.load());
+    assert(3 == runs.load());
+  }
+
+  {
+    PersistentMap<int, int> m;
+    PersistentMap<int, int, CollidingHash> c;
+
+    for (int k = 0; k < 1000; ++k) {
+      m = m.set(k, k * 2);
+    }
+
+    for (int k = 0; k < 40; ++k) {
+      c = c.set(k, k * 2);
+    }
+
+    const auto m2 = m.set(7, 70).erase(8);
+    const auto c2 = c.set(7, 70).erase(8);
+
+    assert(1000 == m.size() && 999 == m2.size());
+    assert(40 == c.size() && 39 == c2.size());
+
+    // older versions are untouched
+    for (int k = 0; k < 1000; ++k) {
+      assert(m.find(k) && k * 2 == *m.find(k));
+    }
+
+    for (int k = 0; k < 40; ++k) {
+      assert(c.find(k) && k * 2 == *c.find(k));
+    }
+
+    assert(70 == *m2.find(7) && !m2.find(8) && 18 == *m2.find(9));
+    assert(70 == *c2.find(7) && !c2.find(8) && 18 == *c2.find(9));
+    assert(!m.find(1000) && !c.find(40));
+    assert(c2.erase(40).same_version(c2));
+
+    for (int k = 0; k < 40; ++k) {
+      c = c.erase(k);
+    }
+
+    assert(c.empty() && !c.find(0));
+
+    SnapshotSlot<int, int> slot{&std::this_thread::yield};
+    PersistentMap<int, int> snapshot;
+
+    bool success = slot.try_put(m2);
+    assert(success);
+
+    success = slot.try_read_into(snapshot);
+    assert(success);
+    assert(snapshot.same_version(m2));
+  }
+
+  {
+    DisposableTable<int> a{&std::this_thread::yield, 100};
+    HeldTable b{&std::this_thread::yield, 100};
+    char path[] = "/tmp/disposable_snapshot_XXXXXX";
+    int v;
+    bool success;
+
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    for (size_t i = 0; i < a.size(); i += 2) {
+      success = a.try_put(i, i * 3);
+      assert(success);
+    }
+
+    success = a.write_snapshot(path);
+    assert(success);
+
+    // slots absent from the snapshot keep their values
+    success = b.try_put(1, 7);
+    assert(success);
+
+    success = b.bulk_load(path, 4);
+    assert(success);
+    assert(b.ready());
+
+    for (size_t i = 0; i < b.size(); ++i) {
+      success = b.try_read_into(i, v);
+      assert(success == (i % 2 == 0 || i == 1));
+      assert(!success || v == (i == 1 ? 7 : static_cast<int>(i * 3)));
+    }
+
+    success = b.try_put(0, 5);
+    assert(success);
+
+    b.hold(true);
+    assert(!b.ready());
+    success = b.try_read_into(0, v);
+    assert(!success);
+
+    b.hold(false);
+    success = b.try_read_into(0, v);
+    assert(success);
+    assert(5 == v);
+
+    // a late reader leaves the value in place while the gate is closed
+    success = b.try_put(0, 9);
+    assert(success);
+
+    b.hold(true);
+    success = b.read_past_gate(0, v);
+    assert(!success);
+
+    b.hold(false);
+    success = b.read_past_gate(0, v);
+    assert(success);
+    assert(9 == v);
+
+    // reloading a table which is already in use
+    success = b.try_put(3, 11);
+    assert(success);
+
+    success = b.bulk_load(path, 4);
+    assert(success);
+    assert(b.ready());
+    unlink(path);
+
+    success = b.try_read_into(2, v);
+    assert(success);
+    assert(6 == v);
+
+    success = b.try_read_into(3, v);
+    assert(success);
+    assert(11 == v);
+  }
+
+  // closest isolated pair if there is one, otherwise the closest pair of any CPUs
+  const CpuTopology topology;
+  CpuPair pair = topology.propose_pair();
+
+  if (!pair.valid()) {
+    PlacementOptions opts;
+    opts.isolated_only = false;
+    pair = topology.propose_pair(opts);
+  }
+
   thr1 = std::thread([&cont] () { Producer(cont); });
   thr2 = std::thread([&cont] () { Consumer(cont); });
 
+  if (pair.valid()) {
+    pin_thread(thr1, pair.producer);
+    pin_thread(thr2, pair.consumer);
+  }
+
   thr1.join();
   thr2.join();
 
@@ -0,0 +1,319 @@
+#include "disposable.h"
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#pragma once
+
+/**
+ * Persistent (immutable, structurally shared) hash map: a hash array mapped trie with separate
+ * bitmaps for inline entries and subtries (CHAMP layout).
+ *
+ * Every update returns a new version sharing all untouched nodes with the previous one, so an update
+ * costs O(log32 n) node copies and copying a version is a single reference count increment.
+ * That makes it a cheap payload for latest-value slots, see SnapshotSlot below: the producer keeps
+ * applying updates to its current version and publishes it in O(1), the consumer gets an immutable
+ * snapshot. Nodes are reference counted and released once no version refers to them.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class PersistentMap {
+public:
+    using Key = K;
+    using Value = V;
+
+    PersistentMap() = default;
+
+    size_t size() const { return _size; }
+    bool empty() const { return !_size; }
+
+    // Whether both maps are the very same version
+    bool same_version(const PersistentMap &other) const { return _root == other._root; }
+
+    /**
+     * \returns pointer to the value or \c nullptr if there's no such key;
+     * valid as long as any version sharing the node is alive
+     */
+    const V *find(const K &k) const {
+        const uint64_t h = _hash(k);
+        const Node *n = _root.get();
+
+        for (unsigned shift = 0; n; shift += BITS) {
+            if (shift >= HASH_BITS) {
+                for (const auto &e : n->data) {
+                    if (Equal{}(e.first, k)) {
+                        return &e.second;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            const uint32_t bit = _bit(h, shift);
+
+            if (n->datamap & bit) {
+                const auto &e = n->data[_index(n->datamap, bit)];
+                return Equal{}(e.first, k) ? &e.second : nullptr;
+            }
+
+            if (!(n->nodemap & bit)) {
+                return nullptr;
+            }
+
+            n = n->nodes[_index(n->nodemap, bit)].get();
+        }
+
+        return nullptr;
+    }
+
+    // New version with the key set to the value
+    PersistentMap set(const K &k, const V &v) const {
+        bool added = false;
+        NodePtr root = _set(_root.get(), 0, _hash(k), k, v, added);
+
+        return PersistentMap{std::move(root), _size + added};
+    }
+
+    // New version without the key, the same version if there's no such key
+    PersistentMap erase(const K &k) const {
+        if (!_root) {
+            return *this;
+        }
+
+        bool removed = false;
+        NodePtr root = _erase(*_root, 0, _hash(k), k, removed);
+
+        return removed ? PersistentMap{std::move(root), _size - 1} : *this;
+    }
+
+    // Call f(key, value) for every entry in unspecified order
+    template <typename F>
+    void for_each(F &&f) const {
+        if (_root) {
+            _for_each(*_root, f);
+        }
+    }
+
+protected:
+    static constexpr unsigned BITS = 5;
+    static constexpr unsigned HASH_BITS = 64;
+    static constexpr uint64_t MASK = (1u << BITS) - 1;
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    // nodes at depth HASH_BITS / BITS and deeper are collision lists with data only and no bitmaps
+    struct Node {
+        uint32_t datamap = 0;
+        uint32_t nodemap = 0;
+        std::vector<std::pair<K, V>> data;
+        std::vector<NodePtr> nodes;
+    };
+
+    NodePtr _root;
+    size_t _size = 0;
+
+    PersistentMap(NodePtr root, size_t size) : _root{std::move(root)}, _size{size} {}
+
+    static uint64_t _hash(const K &k) {
+        // std::hash is often an identity, mix the bits so that every level gets some entropy
+        uint64_t h = static_cast<uint64_t>(Hash{}(k));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+
+        return h;
+    }
+
+    static uint32_t _bit(uint64_t h, unsigned shift) { return uint32_t{1} << ((h >> shift) & MASK); }
+
+    static unsigned _index(uint32_t bitmap, uint32_t bit) { return __builtin_popcount(bitmap & (bit - 1)); }
+
+    // node holding two entries with different keys
+    static NodePtr _merge(unsigned shift, std::pair<K, V> &&a, uint64_t ha, std::pair<K, V> &&b, uint64_t hb) {
+        std::shared_ptr<Node> n{new Node};
+
+        if (shift >= HASH_BITS) {
+            n->data.push_back(std::move(a));
+            n->data.push_back(std::move(b));
+
+            return n;
+        }
+
+        const uint32_t bit_a = _bit(ha, shift);
+        const uint32_t bit_b = _bit(hb, shift);
+
+        if (bit_a == bit_b) {
+            n->nodemap = bit_a;
+            n->nodes.push_back(_merge(shift + BITS, std::move(a), ha, std::move(b), hb));
+        } else {
+            n->datamap = bit_a | bit_b;
+
+            if (bit_a < bit_b) {
+                n->data.push_back(std::move(a));
+                n->data.push_back(std::move(b));
+            } else {
+                n->data.push_back(std::move(b));
+                n->data.push_back(std::move(a));
+            }
+        }
+
+        return n;
+    }
+
+    static NodePtr _set(const Node *n, unsigned shift, uint64_t h, const K &k, const V &v, bool &added) {
+        std::shared_ptr<Node> copy{n ? new Node{*n} : new Node};
+
+        if (shift >= HASH_BITS) {
+            for (auto &e : copy->data) {
+                if (Equal{}(e.first, k)) {
+                    e.second = v;
+                    return copy;
+                }
+            }
+
+            copy->data.emplace_back(k, v);
+            added = true;
+
+            return copy;
+        }
+
+        const uint32_t bit = _bit(h, shift);
+
+        if (copy->datamap & bit) {
+            const unsigned idx = _index(copy->datamap, bit);
+            auto &e = copy->data[idx];
+
+            if (Equal{}(e.first, k)) {
+                e.second = v;
+                return copy;
+            }
+
+            // push both entries one level down
+            const uint64_t he = _hash(e.first);
+            NodePtr child = _merge(shift + BITS, std::move(e), he, std::make_pair(k, v), h);
+
+            copy->data.erase(copy->data.begin() + idx);
+            copy->datamap &= ~bit;
+            copy->nodemap |= bit;
+            copy->nodes.insert(copy->nodes.begin() + _index(copy->nodemap, bit), std::move(child));
+            added = true;
+
+            return copy;
+        }
+
+        if (copy->nodemap & bit) {
+            NodePtr &child = copy->nodes[_index(copy->nodemap, bit)];
+            child = _set(child.get(), shift + BITS, h, k, v, added);
+
+            return copy;
+        }
+
+        copy->datamap |= bit;
+        copy->data.insert(copy->data.begin() + _index(copy->datamap, bit), std::make_pair(k, v));
+        added = true;
+
+        return copy;
+    }
+
+    // nullptr for an empty node
+    static NodePtr _erase(const Node &n, unsigned shift, uint64_t h, const K &k, bool &removed) {
+        if (shift >= HASH_BITS) {
+            for (size_t i = 0; i < n.data.size(); ++i) {
+                if (Equal{}(n.data[i].first, k)) {
+                    if (n.data.size() == 1) {
+                        removed = true;
+                        return nullptr;
+                    }
+
+                    std::shared_ptr<Node> copy{new Node{n}};
+                    copy->data.erase(copy->data.begin() + i);
+                    removed = true;
+
+                    return copy;
+                }
+            }
+
+            return nullptr;
+        }
+
+        const uint32_t bit = _bit(h, shift);
+
+        if (n.datamap & bit) {
+            const unsigned idx = _index(n.datamap, bit);
+
+            if (!Equal{}(n.data[idx].first, k)) {
+                return nullptr;
+            }
+
+            removed = true;
+
+            if (n.data.size() == 1 && n.nodes.empty()) {
+                return nullptr;
+            }
+
+            std::shared_ptr<Node> copy{new Node{n}};
+            copy->data.erase(copy->data.begin() + idx);
+            copy->datamap &= ~bit;
+
+            return copy;
+        }
+
+        if (!(n.nodemap & bit)) {
+            return nullptr;
+        }
+
+        const unsigned idx = _index(n.nodemap, bit);
+        NodePtr child = _erase(*n.nodes[idx], shift + BITS, h, k, removed);
+
+        if (!removed) {
+            return nullptr;
+        }
+
+        std::shared_ptr<Node> copy{new Node{n}};
+
+        if (child && (child->nodes.size() || child->data.size() > 1)) {
+            copy->nodes[idx] = std::move(child);
+            return copy;
+        }
+
+        copy->nodes.erase(copy->nodes.begin() + idx);
+        copy->nodemap &= ~bit;
+
+        // a single entry left below is pulled up into this node
+        if (child) {
+            copy->datamap |= bit;
+            copy->data.insert(copy->data.begin() + _index(copy->datamap, bit), child->data.front());
+        }
+
+        if (copy->data.empty() && copy->nodes.empty()) {
+            return nullptr;
+        }
+
+        return copy;
+    }
+
+    template <typename F>
+    static void _for_each(const Node &n, F &f) {
+        for (const auto &e : n.data) {
+            f(e.first, e.second);
+        }
+
+        for (const auto &c : n.nodes) {
+            _for_each(*c, f);
+        }
+    }
+};
+
+/**
+ * Latest-value slot publishing versions of a persistent map.
+ * Both try_put and try_read_into copy a single pointer; the consumer's previous snapshot is released
+ * inside try_read_into, so a consumer may drop it beforehand to keep the read block short.
+ */
+template <typename K, typename V, typename YieldF = void (*)(), unsigned int block_retries = 2,
+          typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+using SnapshotSlot = Disposable<PersistentMap<K, V, Hash, Equal>, YieldF, block_retries>;
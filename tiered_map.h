@@ -0,0 +1,411 @@
+#include "disposable.h"
+
+#include <atomic>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#pragma once
+
+/**
+ * Latest-value storage for a large number of keys with memory bounded by the hot set.
+ *
+ * Hot keys live in a fixed table of Disposable slots. When the table is full the least recently
+ * used slot (CLOCK approximation) is evicted into an mmap-backed open addressing table in a file,
+ * together with the unread flag, and faulted back in when the key is accessed again.
+ * Reading a cold key which has no unread value doesn't fault it in.
+ *
+ * Hits only take a shared lock and then go through the usual Disposable protocol,
+ * faults and evictions take the lock exclusively.
+ *
+ * Keys and values are stored in the file as is, so both have to be trivially copyable.
+ * It's assumed that there's only one Producer and a single Consumer.
+ */
+template <typename Key, typename T, typename YieldF = void (*)(), unsigned int block_retries = 2,
+          typename Hash = std::hash<Key>>
+class TieredDisposableMap {
+public:
+    using KeyType = Key;
+    using Type = T;
+    using Yielder = YieldF;
+    static constexpr unsigned int BLOCK_RETRIES = block_retries;
+
+    static_assert(std::is_trivially_copyable<Key>::value, "Cold keys are stored in a file");
+    static_assert(std::is_trivially_copyable<T>::value, "Cold values are stored in a file");
+
+    /**
+     * \param hot_capacity number of keys kept in memory
+     */
+    TieredDisposableMap(Yielder &&yield, size_t hot_capacity) {
+        _hot.reserve(hot_capacity);
+        _index.reserve(hot_capacity);
+
+        for (size_t i = 0; i < hot_capacity; ++i) {
+            _hot.emplace_back(new HotSlot{Yielder{yield}});
+        }
+    }
+
+    TieredDisposableMap(const TieredDisposableMap &) = delete;
+    TieredDisposableMap &operator=(const TieredDisposableMap &) = delete;
+
+    ~TieredDisposableMap() { _close(); }
+
+    /**
+     * Create the cold tier file, truncating an existing one.
+     * Has to be called before any put.
+     *
+     * \param cold_capacity number of cold records, rounded up to a power of 2; should comfortably exceed the key count
+     * \returns \c false if the file couldn't be created or mapped
+     */
+    bool open(const char *path, size_t cold_capacity) {
+        _close();
+
+        size_t capacity = 1;
+
+        while (capacity < cold_capacity) {
+            capacity <<= 1;
+        }
+
+        const size_t size = sizeof(ColdHeader) + capacity * sizeof(ColdRecord);
+
+        _fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (_fd < 0) {
+            return false;
+        }
+
+        if (ftruncate(_fd, size) != 0) {
+            _close();
+            return false;
+        }
+
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+        if (p == MAP_FAILED) {
+            _close();
+            return false;
+        }
+
+        _map = static_cast<unsigned char *>(p);
+        _map_size = size;
+
+        ColdHeader *h = _header();
+        memcpy(h->magic, ColdHeader::MAGIC, sizeof(h->magic));
+        h->capacity = capacity;
+        h->key_size = sizeof(Key);
+        h->value_size = sizeof(T);
+        h->count = 0;
+
+        return true;
+    }
+
+    /**
+     * Non-blocking write. Faults the key in, evicting another one if required.
+     *
+     * \returns \c true if write was successfull, \c false if the operation was blocked by simultaneous read
+     * or the cold tier is full
+     */
+    bool try_put(const Key &k, const T &v) {
+        {
+            std::shared_lock<std::shared_mutex> lock{_lock};
+            HotSlot *s = _find_hot(k);
+
+            if (s) {
+                return s->slot.try_put(v);
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock{_lock};
+        HotSlot *s = _find_hot(k);
+
+        if (!s) {
+            s = _fault_in(k, true);
+        }
+
+        return s && s->slot.try_put(v);
+    }
+
+    /**
+     * Non-blocking read and copy. A cold key is faulted in only if it holds an unread value.
+     *
+     * \returns \c true if copy was successfull, \c false if the read was blocked by simultaneous write,
+     * the storage was empty or the key is unknown
+     */
+    bool try_read_into(const Key &k, T &ret) {
+        {
+            std::shared_lock<std::shared_mutex> lock{_lock};
+            HotSlot *s = _find_hot(k);
+
+            if (s) {
+                return s->slot.try_read_into(ret);
+            }
+
+            const ColdRecord *r = _find_cold(k);
+
+            if (!r || !r->unread) {
+                return false;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock{_lock};
+        HotSlot *s = _find_hot(k);
+
+        if (!s) {
+            s = _fault_in(k, false);
+        }
+
+        return s && s->slot.try_read_into(ret);
+    }
+
+    /**
+     * Warm up every hot slot, see Disposable::warm_up, and ask the kernel to read the cold tier ahead.
+     * The dummy handoffs walk all hot slots from one producer and one consumer thread.
+     * Pages locked with opts.lock_memory stay locked after the map is gone unless released,
+     * see release_memory. Must not run concurrently with any other operation.
+     *
+     * \returns \c false if any hot slot couldn't be locked in memory
+     */
+    bool warm_up(const WarmUpOptions &opts = WarmUpOptions{}) {
+        bool locked = true;
+        std::vector<Slot *> slots;
+        // a used slot keeps its value and unread flag
+        std::vector<T> values(_hot.size());
+        std::vector<bool> unread(_hot.size());
+
+        if (opts.lock_memory) {
+            locked = warm_up_memory(_hot.data(), _hot.size() * sizeof(_hot[0])) && locked;
+        }
+
+        for (size_t i = 0; i < _hot.size(); ++i) {
+            HotSlot &s = *_hot[i];
+
+            if (opts.lock_memory) {
+                locked = warm_up_memory(&s, sizeof(s)) && locked;
+            }
+
+            unread[i] = s.used && s.slot.export_into(values[i]);
+            slots.push_back(&s.slot);
+        }
+
+        warm_up_handoffs(slots.data(), slots.size(), opts);
+
+        for (size_t i = 0; i < _hot.size(); ++i) {
+            HotSlot &s = *_hot[i];
+            s.slot.reset_after_warm_up();
+
+            if (s.used) {
+                s.slot.import(&values[i], unread[i]);
+            }
+        }
+
+        if (_map) {
+            madvise(_map, _map_size, MADV_WILLNEED);
+        }
+
+        return locked;
+    }
+
+    size_t hot_capacity() const { return _hot.size(); }
+
+    unsigned long long faults() const { return _faults.load(std::memory_order_relaxed); }
+    unsigned long long evictions() const { return _evictions.load(std::memory_order_relaxed); }
+
+protected:
+    class Slot : public Disposable<T, YieldF, block_retries> {
+    public:
+        using Base = Disposable<T, YieldF, block_retries>;
+
+        Slot(YieldF &&yield) : Base{std::move(yield)} {}
+
+        // exclusive access only, returns whether the value is unread
+        bool export_into(T &ret) const {
+            ret = this->_storage;
+            return !(this->_state.load() & Base::STATE_STORAGE_EMPTY_MASK);
+        }
+
+        // exclusive access only, after warm_up_handoffs
+        void reset_after_warm_up() { this->_reset_after_warm_up(); }
+
+        // exclusive access only, v is \c nullptr for a brand new key
+        void import(const T *v, bool unread) {
+            if (v) {
+                this->_storage = *v;
+            }
+
+            this->_published = v != nullptr;
+            this->_state.store(unread ? 0 : Base::STATE_STORAGE_EMPTY_MASK);
+        }
+    };
+
+    struct HotSlot {
+        HotSlot(YieldF &&yield) : slot{std::move(yield)} {}
+
+        Slot slot;
+        Key key;
+        bool used = false;
+        std::atomic<bool> referenced{false};
+    };
+
+    struct ColdHeader {
+        static constexpr char MAGIC[8] = {'D', 'S', 'P', 'C', 'O', 'L', 'D', '\0'};
+
+        char magic[8];
+        uint64_t capacity;
+        uint32_t key_size;
+        uint32_t value_size;
+        uint64_t count;
+    };
+
+    // a record stays when its key is faulted in and is overwritten by the next eviction of that key
+    struct ColdRecord {
+        uint8_t used;
+        uint8_t unread;
+        Key key;
+        T value;
+    };
+
+    std::vector<std::unique_ptr<HotSlot>> _hot;
+    std::unordered_map<Key, size_t, Hash> _index;
+    size_t _clock_hand = 0;
+
+    int _fd = -1;
+    unsigned char *_map = nullptr;
+    size_t _map_size = 0;
+
+    mutable std::shared_mutex _lock;
+    std::atomic<unsigned long long> _faults{0};
+    std::atomic<unsigned long long> _evictions{0};
+
+    ColdHeader *_header() const { return reinterpret_cast<ColdHeader *>(_map); }
+
+    ColdRecord *_records() const { return reinterpret_cast<ColdRecord *>(_map + sizeof(ColdHeader)); }
+
+    void _close() {
+        if (_map) {
+            munmap(_map, _map_size);
+            _map = nullptr;
+        }
+
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    HotSlot *_find_hot(const Key &k) {
+        const auto it = _index.find(k);
+
+        if (it == _index.end()) {
+            return nullptr;
+        }
+
+        HotSlot *s = _hot[it->second].get();
+        s->referenced.store(true, std::memory_order_relaxed);
+
+        return s;
+    }
+
+    // the record of the key or the empty one where it would be inserted, nullptr if the table is full
+    ColdRecord *_probe_cold(const Key &k) const {
+        if (!_map) {
+            return nullptr;
+        }
+
+        const uint64_t capacity = _header()->capacity;
+        // std::hash is often an identity, spread it over the table
+        uint64_t idx = (static_cast<uint64_t>(Hash{}(k)) * 0x9e3779b97f4a7c15ull) >> 32;
+
+        for (uint64_t i = 0; i < capacity; ++i) {
+            ColdRecord &r = _records()[(idx + i) & (capacity - 1)];
+
+            if (!r.used || !memcmp(&r.key, &k, sizeof(Key))) {
+                return &r;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const ColdRecord *_find_cold(const Key &k) const {
+        const ColdRecord *r = _probe_cold(k);
+        return r && r->used ? r : nullptr;
+    }
+
+    // exclusive lock only
+    size_t _pick_victim() {
+        for (;;) {
+            const size_t idx = _clock_hand;
+            _clock_hand = (_clock_hand + 1) % _hot.size();
+
+            HotSlot &s = *_hot[idx];
+
+            if (!s.used || !s.referenced.exchange(false, std::memory_order_relaxed)) {
+                return idx;
+            }
+        }
+    }
+
+    // exclusive lock only
+    bool _evict(HotSlot &s) {
+        ColdRecord *r = _probe_cold(s.key);
+
+        if (!r) {
+            return false;
+        }
+
+        if (!r->used) {
+            ++_header()->count;
+        }
+
+        r->unread = s.slot.export_into(r->value);
+        memcpy(&r->key, &s.key, sizeof(Key));
+        r->used = 1;
+
+        _index.erase(s.key);
+        s.used = false;
+        _evictions.fetch_add(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // exclusive lock only
+    HotSlot *_fault_in(const Key &k, bool create) {
+        const ColdRecord *r = _find_cold(k);
+
+        if (!r && !create) {
+            return nullptr;
+        }
+
+        if (_hot.empty()) {
+            return nullptr;
+        }
+
+        const size_t idx = _pick_victim();
+        HotSlot &s = *_hot[idx];
+
+        if (s.used && !_evict(s)) {
+            return nullptr;
+        }
+
+        s.key = k;
+        s.used = true;
+        s.referenced.store(true, std::memory_order_relaxed);
+        s.slot.import(r ? &r->value : nullptr, r && r->unread);
+        _index.emplace(k, idx);
+
+        if (r) {
+            _faults.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return &s;
+    }
+};
@@ -0,0 +1,330 @@
+#include "affinity.h"
+
+#include <algorithm>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#pragma once
+
+/**
+ * CPU and cache topology read from sysfs, used to place producer/consumer pairs.
+ *
+ * Handoff latency mostly depends on the closest level shared by the two CPUs: siblings of one
+ * core (SMT) exchange the lines through L1, then come a shared L2, a shared L3 and the interconnect.
+ * CpuTopology ranks pairs of CPUs by that and proposes the closest ones, optionally restricted
+ * to CPUs isolated from the scheduler (isolcpus=), so that nothing else runs there.
+ */
+
+// Closest level shared by two CPUs, ordered from the best one
+enum class Locality : uint8_t {
+    SMT,
+    L2,
+    L3,
+    PACKAGE,
+    NONE,
+};
+
+inline const char *locality_name(Locality l) {
+    switch (l) {
+    case Locality::SMT:
+        return "smt";
+    case Locality::L2:
+        return "l2";
+    case Locality::L3:
+        return "l3";
+    case Locality::PACKAGE:
+        return "package";
+    case Locality::NONE:
+        return "none";
+    }
+
+    return "none";
+}
+
+struct CpuPair {
+    int producer = -1;
+    int consumer = -1;
+    Locality locality = Locality::NONE;
+
+    bool valid() const { return producer >= 0 && consumer >= 0; }
+};
+
+struct PlacementOptions {
+    // only CPUs listed in /sys/devices/system/cpu/isolated
+    bool isolated_only = true;
+    // whether both threads may share a core, SMT siblings also share its execution units
+    bool allow_smt = true;
+};
+
+/**
+ * Parse a sysfs CPU list like "0-3,8,10-11".
+ * \returns \c false if the list is malformed
+ */
+inline bool parse_cpu_list(const char *s, std::vector<int> &ret) {
+    ret.clear();
+
+    while (*s && *s != '\n') {
+        char *end;
+        const long first = strtol(s, &end, 10);
+
+        if (end == s || first < 0) {
+            return false;
+        }
+
+        long last = first;
+        s = end;
+
+        if (*s == '-') {
+            last = strtol(s + 1, &end, 10);
+
+            if (end == s + 1 || last < first) {
+                return false;
+            }
+
+            s = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu) {
+            ret.push_back(static_cast<int>(cpu));
+        }
+
+        if (*s == ',') {
+            ++s;
+        }
+    }
+
+    return true;
+}
+
+class CpuTopology {
+public:
+    /**
+     * Read the topology of the online CPUs the calling thread is allowed to run on.
+     * Missing sysfs entries leave the corresponding levels unshared.
+     */
+    explicit CpuTopology(const char *root = "/sys/devices/system/cpu") {
+        std::vector<int> online;
+        std::string line;
+
+        if (!_read_line(std::string{root} + "/online", line) || !parse_cpu_list(line.c_str(), online)) {
+            return;
+        }
+
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return;
+        }
+
+        std::vector<int> isolated;
+
+        if (_read_line(std::string{root} + "/isolated", line)) {
+            parse_cpu_list(line.c_str(), isolated);
+        }
+
+        for (int cpu : online) {
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+                continue;
+            }
+
+            _cpus.push_back(_read_cpu(root, cpu, std::find(isolated.begin(), isolated.end(), cpu) != isolated.end()));
+        }
+    }
+
+    // Usable CPU numbers
+    std::vector<int> cpus() const {
+        std::vector<int> ret;
+
+        for (const auto &c : _cpus) {
+            ret.push_back(c.cpu);
+        }
+
+        return ret;
+    }
+
+    // Usable isolated CPU numbers
+    std::vector<int> isolated() const {
+        std::vector<int> ret;
+
+        for (const auto &c : _cpus) {
+            if (c.isolated) {
+                ret.push_back(c.cpu);
+            }
+        }
+
+        return ret;
+    }
+
+    // Closest level shared by two different usable CPUs, NONE for unknown ones
+    Locality locality(int a, int b) const {
+        const Cpu *ca = _find(a);
+        const Cpu *cb = _find(b);
+
+        return ca && cb ? _locality(*ca, *cb) : Locality::NONE;
+    }
+
+    /**
+     * Propose up to the given number of disjoint pairs, greedily taking the closest remaining pair,
+     * ties broken by lower CPU numbers.
+     *
+     * \returns fewer pairs if there aren't enough CPUs satisfying the options
+     */
+    std::vector<CpuPair> propose(size_t pairs, const PlacementOptions &opts = PlacementOptions{}) const {
+        std::vector<const Cpu *> free;
+        std::vector<CpuPair> ret;
+
+        for (const auto &c : _cpus) {
+            if (c.isolated || !opts.isolated_only) {
+                free.push_back(&c);
+            }
+        }
+
+        while (ret.size() < pairs) {
+            size_t best_a = 0, best_b = 0;
+            Locality best = Locality::NONE;
+            bool found = false;
+
+            for (size_t a = 0; a < free.size(); ++a) {
+                for (size_t b = a + 1; b < free.size(); ++b) {
+                    const Locality l = _locality(*free[a], *free[b]);
+
+                    if (l == Locality::SMT && !opts.allow_smt) {
+                        continue;
+                    }
+
+                    if (!found || l < best) {
+                        best_a = a;
+                        best_b = b;
+                        best = l;
+                        found = true;
+                    }
+                }
+            }
+
+            if (!found) {
+                break;
+            }
+
+            ret.push_back(CpuPair{free[best_a]->cpu, free[best_b]->cpu, best});
+            free.erase(free.begin() + best_b);
+            free.erase(free.begin() + best_a);
+        }
+
+        return ret;
+    }
+
+    // The closest pair, invalid if there's none
+    CpuPair propose_pair(const PlacementOptions &opts = PlacementOptions{}) const {
+        const std::vector<CpuPair> pairs = propose(1, opts);
+        return pairs.empty() ? CpuPair{} : pairs.front();
+    }
+
+private:
+    // CPUs sharing a level are identified by the lowest CPU of the level's sharing list, -1 if unknown
+    struct Cpu {
+        int cpu;
+        bool isolated;
+        int core;
+        int l2;
+        int l3;
+        int package;
+    };
+
+    std::vector<Cpu> _cpus;
+
+    const Cpu *_find(int cpu) const {
+        for (const auto &c : _cpus) {
+            if (c.cpu == cpu) {
+                return &c;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static Locality _locality(const Cpu &a, const Cpu &b) {
+        if (a.core >= 0 && a.core == b.core) {
+            return Locality::SMT;
+        }
+
+        if (a.l2 >= 0 && a.l2 == b.l2) {
+            return Locality::L2;
+        }
+
+        if (a.l3 >= 0 && a.l3 == b.l3) {
+            return Locality::L3;
+        }
+
+        if (a.package >= 0 && a.package == b.package) {
+            return Locality::PACKAGE;
+        }
+
+        return Locality::NONE;
+    }
+
+    static bool _read_line(const std::string &path, std::string &ret) {
+        FILE *f = fopen(path.c_str(), "r");
+
+        if (!f) {
+            return false;
+        }
+
+        char buf[4096];
+        const bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+        fclose(f);
+
+        if (ok) {
+            ret = buf;
+        }
+
+        return ok;
+    }
+
+    // lowest CPU of the list in the file, -1 if unreadable
+    static int _first_of_list(const std::string &path) {
+        std::string line;
+        std::vector<int> list;
+
+        if (!_read_line(path, line) || !parse_cpu_list(line.c_str(), list) || list.empty()) {
+            return -1;
+        }
+
+        return *std::min_element(list.begin(), list.end());
+    }
+
+    static Cpu _read_cpu(const char *root, int cpu, bool isolated) {
+        const std::string dir = std::string{root} + "/cpu" + std::to_string(cpu);
+        Cpu c{cpu, isolated, -1, -1, -1, -1};
+        std::string line;
+
+        // private levels are identified by the CPU itself and never match another one
+        c.core = _first_of_list(dir + "/topology/thread_siblings_list");
+
+        if (_read_line(dir + "/topology/physical_package_id", line)) {
+            c.package = atoi(line.c_str());
+        }
+
+        for (unsigned idx = 0;; ++idx) {
+            const std::string cache = dir + "/cache/index" + std::to_string(idx);
+
+            if (!_read_line(cache + "/level", line)) {
+                break;
+            }
+
+            const int level = atoi(line.c_str());
+
+            if (level == 2) {
+                c.l2 = _first_of_list(cache + "/shared_cpu_list");
+            } else if (level == 3) {
+                c.l3 = _first_of_list(cache + "/shared_cpu_list");
+            }
+        }
+
+        return c;
+    }
+};
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <stdint.h>
+
+#pragma once
+
+/**
+ * Triple buffered storage for single time-read after the latest write.
+ * Unlike Disposable neither side ever blocks: the producer fills a private back buffer and
+ * swaps it with the shared middle one, the consumer swaps the middle buffer with its private front one.
+ * It's assumed that there's only one Producer and a single Consumer.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    using Type = T;
+
+    TripleBuffer() : _middle{1}, _back{0}, _front{2} {}
+
+    /**
+     * Non-blocking read and copy.
+     * The storage becomes empty on successfull read.
+     *
+     * \param ret target memory location to copy into
+     * \returns \c true if copy was successfull, \c false if the storage was empty.
+     */
+    bool try_read_into(T &ret) {
+        if (!(_middle.load(std::memory_order_relaxed) & FRESH_MASK)) {
+            return false;
+        }
+
+        // only the producer may touch middle meanwhile and it would keep it fresh
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX_MASK;
+        ret = _buffers[_front];
+
+        return true;
+    }
+
+    /**
+     * Wait-free write.
+     *
+     * \param v value to store
+     * \param overwrote set to \c true if an unread value was discarded
+     * \returns always \c true, kept for interface compatibility with Disposable
+     */
+    bool try_put(const T &v, bool *overwrote = nullptr) {
+        _buffers[_back] = v;
+
+        const auto prev = _middle.exchange(_back | FRESH_MASK, std::memory_order_acq_rel);
+        _back = prev & INDEX_MASK;
+
+        if (overwrote) {
+            *overwrote = prev & FRESH_MASK;
+        }
+
+        return true;
+    }
+
+    /**
+     * Whether the consumer has taken the latest value.
+     * The consumer may still be copying it but it does so from a buffer the producer never touches.
+     */
+    bool is_quiescent() const {
+        return !(_middle.load(std::memory_order_acquire) & FRESH_MASK);
+    }
+
+protected:
+    using IndexType = uint8_t;
+
+    static constexpr IndexType INDEX_MASK = 3;
+    static constexpr IndexType FRESH_MASK = 4;
+
+    Type _buffers[3];
+
+    alignas(64) std::atomic<IndexType> _middle;
+    alignas(64) IndexType _back;
+    alignas(64) IndexType _front;
+};
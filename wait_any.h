@@ -0,0 +1,155 @@
+#include "disposable.h"
+#include "futex.h"
+
+#include <assert.h>
+#include <atomic>
+#include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#pragma once
+
+/**
+ * Blocking wait of a consumer for any of several Disposable slots to get a value.
+ *
+ * The consumer announces itself in the state word of every slot and parks on all of them at once
+ * with futex_waitv, so a put into any of the slots wakes it with a single syscall. A put which
+ * doesn't fill the storage, e.g. a silent FilteredDisposable update, doesn't wake it.
+ * A single slot is waited on with a plain futex wait, several slots on kernels without futex_waitv
+ * are polled.
+ *
+ * Every slot is assumed to have this thread as its only consumer.
+ */
+
+struct DisposableWaitAccess {
+    template <typename Slot>
+    static std::atomic<uint32_t> &word(Slot &slot) {
+        return slot._state;
+    }
+
+    template <typename Slot>
+    static constexpr uint32_t empty_mask() {
+        return Slot::STATE_STORAGE_EMPTY_MASK;
+    }
+
+    template <typename Slot>
+    static constexpr uint32_t waiters_mask() {
+        return Slot::STATE_WAITERS_MASK;
+    }
+};
+
+/**
+ * Wait until any of the state words has the empty bit cleared.
+ * Words and masks come from DisposableWaitAccess, see wait_any for the slot based interface.
+ *
+ * \param count number of words, up to FUTEX_WAITV_MAX_WORDS
+ * \param timeout_ns how long to wait, negative to wait forever
+ * \returns index of a word with the empty bit cleared, -1 on timeout
+ */
+inline int wait_any_word(std::atomic<uint32_t> *const *words, size_t count, uint32_t empty_mask,
+                         uint32_t waiters_mask, int64_t timeout_ns) {
+    assert(count && count <= FUTEX_WAITV_MAX_WORDS && "Invalid number of slots");
+
+    // remembered across calls, the syscall doesn't appear at runtime
+    static std::atomic<bool> waitv_unsupported{false};
+
+    timespec deadline{};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    const bool forever = timeout_ns < 0;
+    const int64_t deadline_ns = deadline.tv_sec * 1000000000ll + deadline.tv_nsec + (forever ? 0 : timeout_ns);
+    deadline = timespec{static_cast<time_t>(deadline_ns / 1000000000), static_cast<long>(deadline_ns % 1000000000)};
+
+    uint32_t expected[FUTEX_WAITV_MAX_WORDS];
+    int ret = -1;
+
+    for (;;) {
+        for (size_t i = 0; i < count && ret < 0; ++i) {
+            const uint32_t state = words[i]->fetch_or(waiters_mask) | waiters_mask;
+
+            if (!(state & empty_mask)) {
+                ret = static_cast<int>(i);
+            }
+
+            expected[i] = state;
+        }
+
+        if (ret >= 0) {
+            break;
+        }
+
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        const int64_t left_ns = deadline_ns - (now.tv_sec * 1000000000ll + now.tv_nsec);
+
+        if (!forever && left_ns <= 0) {
+            break;
+        }
+
+        // woken, interrupted or a word changed before we slept, check the words again in any case
+        if (count == 1) {
+            const timespec timeout{static_cast<time_t>(left_ns / 1000000000), static_cast<long>(left_ns % 1000000000)};
+            futex_wait(*words[0], expected[0], forever ? nullptr : &timeout);
+        } else if (!waitv_unsupported.load(std::memory_order_relaxed)) {
+            if (futex_waitv(words, expected, count, forever ? nullptr : &deadline) == ENOSYS) {
+                waitv_unsupported.store(true, std::memory_order_relaxed);
+            }
+        } else {
+            sched_yield();
+        }
+    }
+
+    // whoever filled the storage has cleared the flag of its word already
+    for (size_t i = 0; i < count; ++i) {
+        words[i]->fetch_and(~waiters_mask);
+    }
+
+    return ret;
+}
+
+/**
+ * Wait until any of the slots holds an unread value. The value isn't read, a following
+ * try_read_into may still be blocked by a simultaneous write.
+ *
+ * \param timeout_ns how long to wait, negative to wait forever
+ * \param slots up to FUTEX_WAITV_MAX_WORDS Disposable slots, possibly of different types
+ * \returns index of a slot holding an unread value, -1 on timeout
+ */
+template <typename Slot, typename... Slots>
+int wait_any_for(int64_t timeout_ns, Slot &slot, Slots &... slots) {
+    static_assert(sizeof...(Slots) < FUTEX_WAITV_MAX_WORDS, "Too many slots");
+
+    std::atomic<uint32_t> *words[] = {&DisposableWaitAccess::word(slot), &DisposableWaitAccess::word(slots)...};
+
+    // masks are the same for every Disposable
+    return wait_any_word(words, sizeof...(Slots) + 1, DisposableWaitAccess::empty_mask<Slot>(),
+                         DisposableWaitAccess::waiters_mask<Slot>(), timeout_ns);
+}
+
+// Wait forever until any of the slots holds an unread value, see wait_any_for
+template <typename... Slots>
+int wait_any(Slots &... slots) {
+    return wait_any_for(-1, slots...);
+}
+
+/**
+ * Wait until any of the slots of the same type holds an unread value, see wait_any_for.
+ *
+ * \param count number of slots, up to FUTEX_WAITV_MAX_WORDS
+ */
+template <typename Slot>
+int wait_any_of(Slot *const *slots, size_t count, int64_t timeout_ns = -1) {
+    std::atomic<uint32_t> *words[FUTEX_WAITV_MAX_WORDS];
+
+    assert(count <= FUTEX_WAITV_MAX_WORDS && "Invalid number of slots");
+
+    for (size_t i = 0; i < count; ++i) {
+        words[i] = &DisposableWaitAccess::word(*slots[i]);
+    }
+
+    return wait_any_word(words, count, DisposableWaitAccess::empty_mask<Slot>(),
+                         DisposableWaitAccess::waiters_mask<Slot>(), timeout_ns);
+}
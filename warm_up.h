@@ -0,0 +1,113 @@
+#include "affinity.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+#pragma once
+
+/**
+ * Helpers for warming up slots before the first real update, see Disposable::warm_up.
+ */
+
+struct WarmUpOptions {
+    // CPUs the producer and the consumer are going to run on, negative for any
+    int producer_cpu = -1;
+    int consumer_cpu = -1;
+    // dummy handoffs to run
+    unsigned handoffs = 1024;
+    // fault in and mlock the pages of the storage, which stay locked afterwards, see warm_up_memory
+    bool lock_memory = false;
+};
+
+// Whole pages covering [p, p + size) as [begin, end)
+inline void warm_up_pages(const void *p, size_t size, uintptr_t &begin, uintptr_t &end) {
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    begin = reinterpret_cast<uintptr_t>(p) & ~(page - 1);
+    end = (reinterpret_cast<uintptr_t>(p) + size + page - 1) & ~(page - 1);
+}
+
+/**
+ * Fault in the pages covering [p, p + size) as writable without changing their contents and lock them.
+ * The caller owns the locked pages: they stay locked, counted against RLIMIT_MEMLOCK, until
+ * release_memory is called for the range or the process exits, even if the memory is freed meanwhile.
+ *
+ * \returns \c false if the pages couldn't be locked, e.g. because of RLIMIT_MEMLOCK
+ */
+inline bool warm_up_memory(const void *p, size_t size) {
+    uintptr_t begin, end;
+    warm_up_pages(p, size, begin, end);
+
+#ifdef MADV_POPULATE_WRITE
+    // best effort, mlock below faults the pages in anyway
+    madvise(reinterpret_cast<void *>(begin), end - begin, MADV_POPULATE_WRITE);
+#endif
+
+    return mlock(reinterpret_cast<const void *>(begin), end - begin) == 0;
+}
+
+/**
+ * Unlock the pages locked by warm_up_memory for the same range. Locks aren't counted,
+ * so other memory on those pages is unlocked as well.
+ *
+ * \returns \c false if the pages couldn't be unlocked
+ */
+inline bool release_memory(const void *p, size_t size) {
+    uintptr_t begin, end;
+    warm_up_pages(p, size, begin, end);
+
+    return munlock(reinterpret_cast<const void *>(begin), end - begin) == 0;
+}
+
+// Start a thread running f pinned to the CPU, see pin_this_thread
+template <typename F>
+std::thread warm_up_thread(int cpu, F &&f) {
+    return std::thread([cpu, f = std::forward<F>(f)] () mutable {
+        pin_this_thread(cpu);
+        f();
+    });
+}
+
+/**
+ * Run dummy handoffs through the slots one after another from a single producer thread and a single
+ * consumer thread, pinned to the CPUs of opts. Must not run concurrently with any other operation
+ * on the slots, they are empty afterwards.
+ *
+ * \param slots slots with try_put and try_read_into, e.g. Disposable
+ */
+template <typename Slot>
+void warm_up_handoffs(Slot *const *slots, size_t count, const WarmUpOptions &opts) {
+    // number of slots the producer is done with
+    std::atomic<size_t> done{0};
+
+    std::thread consumer = warm_up_thread(opts.consumer_cpu, [slots, count, &done] () {
+        typename Slot::Type v;
+
+        for (size_t i = 0; i < count; ++i) {
+            while (done.load(std::memory_order_acquire) <= i) {
+                slots[i]->try_read_into(v);
+            }
+
+            // the last value
+            slots[i]->try_read_into(v);
+        }
+    });
+
+    warm_up_thread(opts.producer_cpu, [slots, count, &done, &opts] () {
+        const typename Slot::Type dummy{};
+
+        for (size_t i = 0; i < count; ++i) {
+            for (unsigned j = 0; j < opts.handoffs; ++j) {
+                slots[i]->try_put(dummy);
+            }
+
+            done.store(i + 1, std::memory_order_release);
+        }
+    }).join();
+
+    consumer.join();
+}
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <math.h>
+#include <memory>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#pragma once
+
+/**
+ * Workload generator for the benchmarks: arrival processes producing inter-arrival gaps
+ * and payload size distributions. The producer follows the intended arrival times open-loop,
+ * see run_handoff in bench.h.
+ *
+ * Specs accepted by make_arrivals():
+ *   fixed:NS                               constant gap
+ *   poisson:RATE                           RATE arrivals per second on average
+ *   mmpp:QUIET_RATE,BURST_RATE,QUIET_NS,BURST_NS
+ *                                          two state Markov modulated Poisson process,
+ *                                          states last QUIET_NS and BURST_NS on average
+ *   trace:PATH                             inter-arrival gaps in ns, one per line, replayed in a loop
+ *
+ * Specs accepted by make_sizes():
+ *   fixed:BYTES
+ *   uniform:MIN,MAX
+ *   lognormal:MEDIAN,SIGMA,MAX
+ */
+
+using WorkloadRng = std::mt19937_64;
+
+class ArrivalProcess {
+public:
+    virtual ~ArrivalProcess() = default;
+
+    virtual uint64_t next_gap_ns(WorkloadRng &rng) = 0;
+    virtual const char *name() const = 0;
+};
+
+class FixedArrivals : public ArrivalProcess {
+public:
+    explicit FixedArrivals(uint64_t gap_ns) : _gap_ns{gap_ns} {}
+
+    uint64_t next_gap_ns(WorkloadRng &) override { return _gap_ns; }
+    const char *name() const override { return "fixed"; }
+
+private:
+    uint64_t _gap_ns;
+};
+
+class PoissonArrivals : public ArrivalProcess {
+public:
+    explicit PoissonArrivals(double rate_per_s) : _gap{rate_per_s / 1e9} {}
+
+    uint64_t next_gap_ns(WorkloadRng &rng) override { return static_cast<uint64_t>(_gap(rng)); }
+    const char *name() const override { return "poisson"; }
+
+private:
+    std::exponential_distribution<double> _gap;
+};
+
+class MmppArrivals : public ArrivalProcess {
+public:
+    MmppArrivals(double quiet_rate_per_s, double burst_rate_per_s, double mean_quiet_ns, double mean_burst_ns)
+        : _gap{std::exponential_distribution<double>{quiet_rate_per_s / 1e9},
+               std::exponential_distribution<double>{burst_rate_per_s / 1e9}},
+          _sojourn{std::exponential_distribution<double>{1 / mean_quiet_ns},
+                   std::exponential_distribution<double>{1 / mean_burst_ns}}
+    {}
+
+    uint64_t next_gap_ns(WorkloadRng &rng) override {
+        double gap = 0;
+
+        if (_state_left_ns < 0) {
+            _state_left_ns = _sojourn[_state](rng);
+        }
+
+        // both the arrivals and the state changes are memoryless, so the gap is resampled after a switch
+        for (;;) {
+            const double candidate = _gap[_state](rng);
+
+            if (candidate <= _state_left_ns) {
+                _state_left_ns -= candidate;
+                return static_cast<uint64_t>(gap + candidate);
+            }
+
+            gap += _state_left_ns;
+            _state ^= 1;
+            _state_left_ns = _sojourn[_state](rng);
+        }
+    }
+
+    const char *name() const override { return "mmpp"; }
+
+private:
+    std::exponential_distribution<double> _gap[2];
+    std::exponential_distribution<double> _sojourn[2];
+    unsigned _state = 0;
+    double _state_left_ns = -1;
+};
+
+class TraceArrivals : public ArrivalProcess {
+public:
+    // empty trace if the file can't be read, check with empty()
+    explicit TraceArrivals(const char *path) {
+        FILE *f = fopen(path, "r");
+
+        if (!f) {
+            return;
+        }
+
+        unsigned long long gap;
+
+        while (fscanf(f, "%llu", &gap) == 1) {
+            _gaps.push_back(gap);
+        }
+
+        fclose(f);
+    }
+
+    bool empty() const { return _gaps.empty(); }
+
+    uint64_t next_gap_ns(WorkloadRng &) override {
+        const uint64_t gap = _gaps[_next];
+        _next = (_next + 1) % _gaps.size();
+
+        return gap;
+    }
+
+    const char *name() const override { return "trace"; }
+
+private:
+    std::vector<uint64_t> _gaps;
+    size_t _next = 0;
+};
+
+class SizeDistribution {
+public:
+    enum class Kind {
+        FIXED,
+        UNIFORM,
+        LOGNORMAL,
+    };
+
+    static SizeDistribution fixed(size_t bytes) { return SizeDistribution{Kind::FIXED, bytes, bytes, 0}; }
+    static SizeDistribution uniform(size_t min, size_t max) { return SizeDistribution{Kind::UNIFORM, min, max, 0}; }
+
+    static SizeDistribution lognormal(size_t median, double sigma, size_t max) {
+        return SizeDistribution{Kind::LOGNORMAL, median, max, sigma};
+    }
+
+    size_t next(WorkloadRng &rng) {
+        switch (_kind) {
+        case Kind::FIXED:
+            return _a;
+
+        case Kind::UNIFORM:
+            return std::uniform_int_distribution<size_t>{_a, _b}(rng);
+
+        case Kind::LOGNORMAL:
+            return std::min(_b, static_cast<size_t>(std::lognormal_distribution<double>{log(_a), _sigma}(rng)));
+        }
+
+        return _a;
+    }
+
+    size_t max() const { return _b; }
+
+private:
+    Kind _kind;
+    size_t _a;
+    size_t _b;
+    double _sigma;
+
+    SizeDistribution(Kind kind, size_t a, size_t b, double sigma) : _kind{kind}, _a{a}, _b{b}, _sigma{sigma} {}
+};
+
+struct Workload {
+    std::unique_ptr<ArrivalProcess> arrivals;
+    SizeDistribution sizes = SizeDistribution::fixed(64);
+    WorkloadRng rng{42};
+};
+
+/**
+ * Parse an arrival process spec.
+ * \returns \c nullptr if the spec is malformed or the trace is unreadable
+ */
+inline std::unique_ptr<ArrivalProcess> make_arrivals(const char *spec) {
+    double a, b, c, d;
+
+    if (sscanf(spec, "fixed:%lf", &a) == 1 && a >= 0) {
+        return std::unique_ptr<ArrivalProcess>{new FixedArrivals(static_cast<uint64_t>(a))};
+    }
+
+    if (sscanf(spec, "poisson:%lf", &a) == 1 && a > 0) {
+        return std::unique_ptr<ArrivalProcess>{new PoissonArrivals(a)};
+    }
+
+    if (sscanf(spec, "mmpp:%lf,%lf,%lf,%lf", &a, &b, &c, &d) == 4 && a > 0 && b > 0 && c > 0 && d > 0) {
+        return std::unique_ptr<ArrivalProcess>{new MmppArrivals(a, b, c, d)};
+    }
+
+    if (!strncmp(spec, "trace:", 6)) {
+        std::unique_ptr<TraceArrivals> trace{new TraceArrivals(spec + 6)};
+
+        if (!trace->empty()) {
+            return trace;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Parse a payload size distribution spec.
+ * \returns \c false if the spec is malformed
+ */
+inline bool make_sizes(const char *spec, SizeDistribution &ret) {
+    unsigned long long a, b;
+    double sigma;
+
+    if (sscanf(spec, "fixed:%llu", &a) == 1) {
+        ret = SizeDistribution::fixed(a);
+        return true;
+    }
+
+    if (sscanf(spec, "uniform:%llu,%llu", &a, &b) == 2 && a <= b) {
+        ret = SizeDistribution::uniform(a, b);
+        return true;
+    }
+
+    if (sscanf(spec, "lognormal:%llu,%lf,%llu", &a, &sigma, &b) == 3 && a > 0 && sigma >= 0) {
+        ret = SizeDistribution::lognormal(a, sigma, b);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,70 @@
+#include "cpu_features.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#pragma once
+
+/**
+ * Wait strategies usable as Disposable Yielder and for consumers polling an empty slot.
+ * All of them are stateless functors, e.g. Disposable<T, SpinYielder> d{SpinYielder{}}.
+ */
+
+// Busy spin with a pause hint
+struct SpinYielder {
+    static constexpr const char *NAME = "spin";
+
+    void operator()() const {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+};
+
+// Give the CPU away to another runnable thread
+struct ThreadYielder {
+    static constexpr const char *NAME = "yield";
+
+    void operator()() const { sched_yield(); }
+};
+
+/**
+ * Light sleep in the C0.2 power state for a few microseconds with TPAUSE,
+ * the address-less sibling of UMWAIT. Falls back to a pause hint without WAITPKG.
+ */
+struct TpauseYielder {
+    static constexpr const char *NAME = "umwait";
+    static constexpr uint64_t TICKS = 10000;
+
+    void operator()() const {
+#if defined(__x86_64__) || defined(__i386__)
+        if (CpuFeatures::get().waitpkg()) {
+            const uint64_t deadline = __rdtsc() + TICKS;
+
+            // tpause %ecx, encoded manually to avoid requiring -mwaitpkg
+            asm volatile(".byte 0x66, 0x0f, 0xae, 0xf1"
+                         :
+                         : "c"(0), "d"(static_cast<uint32_t>(deadline >> 32)), "a"(static_cast<uint32_t>(deadline))
+                         : "cc", "memory");
+        } else {
+            _mm_pause();
+        }
+#endif
+    }
+};
+
+// Park the thread in the kernel for a short while
+struct ParkYielder {
+    static constexpr const char *NAME = "park";
+    static constexpr long NANOSECONDS = 50000;
+
+    void operator()() const {
+        const timespec ts{0, NANOSECONDS};
+        nanosleep(&ts, nullptr);
+    }
+};